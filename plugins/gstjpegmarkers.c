@@ -0,0 +1,607 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Byte level helpers for walking JPEG marker segments, shared by the
+ * elements of this plugin. Nothing here decodes image data. */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+#include "gstjpegmarkers.h"
+
+/**
+ * gst_jpeg_parse_frame_info:
+ *
+ * Walks the marker segments from SOI up to the first SOS and fills @info.
+ * Returns FALSE for truncated or malformed headers.
+ */
+gboolean
+gst_jpeg_parse_frame_info (const guint8 * data, gsize size,
+    GstJpegFrameInfo * info)
+{
+  gboolean have_sof = FALSE;
+  gsize offset = 2;
+
+  memset (info, 0, sizeof (*info));
+
+  if (size < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI)
+    return FALSE;
+
+  while (offset + 4 <= size) {
+    const guint8 *seg;
+    guint8 marker;
+    guint length;
+
+    if (data[offset] != 0xFF)
+      return FALSE;
+    /* any number of fill bytes may precede a marker */
+    while (offset + 1 < size && data[offset + 1] == 0xFF)
+      offset++;
+    if (offset + 4 > size)
+      return FALSE;
+
+    marker = data[offset + 1];
+    length = GST_READ_UINT16_BE (data + offset + 2);
+    if (length < 2 || offset + 2 + length > size)
+      return FALSE;
+    seg = data + offset + 4;
+
+    if (JPEG_MARKER_IS_SOF (marker)) {
+      guint i;
+
+      if (length < 8)
+        return FALSE;
+      info->sof_marker = marker;
+      info->sof_offset = offset;
+      info->height = GST_READ_UINT16_BE (seg + 1);
+      info->width = GST_READ_UINT16_BE (seg + 3);
+      info->n_components = seg[5];
+      if (info->n_components == 0 || info->n_components > JPEG_MAX_COMPONENTS
+          || length < 8 + 3 * info->n_components)
+        return FALSE;
+
+      for (i = 0; i < info->n_components; i++) {
+        guint8 samp = seg[6 + 3 * i + 1];
+
+        info->h_samp[i] = samp >> 4;
+        info->v_samp[i] = samp & 0x0F;
+        if (info->h_samp[i] == 0 || info->v_samp[i] == 0)
+          return FALSE;
+        info->max_h_samp = MAX (info->max_h_samp, info->h_samp[i]);
+        info->max_v_samp = MAX (info->max_v_samp, info->v_samp[i]);
+      }
+      have_sof = TRUE;
+    } else if (marker == JPEG_MARKER_DRI) {
+      if (length < 4)
+        return FALSE;
+      info->dri_offset = offset;
+      info->restart_interval = GST_READ_UINT16_BE (seg);
+    } else if (marker == JPEG_MARKER_SOS) {
+      if (!have_sof || length < 3)
+        return FALSE;
+      info->sos_offset = offset;
+      info->scan_components = seg[0];
+      info->scan_offset = offset + 2 + length;
+      return TRUE;
+    }
+
+    offset += 2 + length;
+  }
+
+  return FALSE;
+}
+
+/**
+ * gst_jpeg_next_segment:
+ *
+ * Returns the header segment at @offset in @seg and moves @offset past
+ * it, start with @offset 2 to skip SOI. Returns %FALSE at SOS, EOI or
+ * anything that is not a complete segment.
+ */
+gboolean
+gst_jpeg_next_segment (const guint8 * data, gsize size, gsize * offset,
+    GstJpegSegment * seg)
+{
+  gsize o = *offset;
+  guint length;
+
+  if (o + 4 > size || data[o] != 0xFF)
+    return FALSE;
+  while (o + 1 < size && data[o + 1] == 0xFF)
+    o++;
+  if (o + 4 > size)
+    return FALSE;
+
+  seg->marker = data[o + 1];
+  if (seg->marker == JPEG_MARKER_SOS || seg->marker == JPEG_MARKER_EOI)
+    return FALSE;
+  length = GST_READ_UINT16_BE (data + o + 2);
+  if (length < 2 || o + 2 + length > size)
+    return FALSE;
+
+  seg->offset = o;
+  seg->size = 2 + length;
+  seg->data = data + o + 4;
+  seg->length = length - 2;
+  *offset = o + 2 + length;
+
+  return TRUE;
+}
+
+/* sequential Huffman coded, a single scan carries all coefficients */
+gboolean
+gst_jpeg_frame_info_is_baseline (const GstJpegFrameInfo * info)
+{
+  return info->sof_marker == JPEG_MARKER_SOF0 ||
+      info->sof_marker == JPEG_MARKER_SOF1;
+}
+
+/* a non-interleaved scan codes one 8x8 block per MCU */
+guint
+gst_jpeg_frame_info_mcu_width (const GstJpegFrameInfo * info)
+{
+  if (info->scan_components <= 1)
+    return 8;
+  return 8 * info->max_h_samp;
+}
+
+guint
+gst_jpeg_frame_info_mcu_height (const GstJpegFrameInfo * info)
+{
+  if (info->scan_components <= 1)
+    return 8;
+  return 8 * info->max_v_samp;
+}
+
+guint
+gst_jpeg_frame_info_mcus_per_row (const GstJpegFrameInfo * info)
+{
+  guint mcu_width = gst_jpeg_frame_info_mcu_width (info);
+
+  return (info->width + mcu_width - 1) / mcu_width;
+}
+
+#define EXIF_TAG_ORIENTATION 0x0112
+#define EXIF_TYPE_SHORT 3
+
+static guint
+exif_read_16 (const guint8 * p, gboolean big_endian)
+{
+  return big_endian ? GST_READ_UINT16_BE (p) : GST_READ_UINT16_LE (p);
+}
+
+static guint32
+exif_read_32 (const guint8 * p, gboolean big_endian)
+{
+  return big_endian ? GST_READ_UINT32_BE (p) : GST_READ_UINT32_LE (p);
+}
+
+/* the TIFF data of an EXIF APP1 segment and the offset of its IFD0 in it */
+static gboolean
+exif_parse_header (const GstJpegSegment * seg, const guint8 ** tiff,
+    guint * tiff_size, gboolean * big_endian, guint32 * ifd)
+{
+  if (seg->marker != JPEG_MARKER_APP1 || seg->length < 6 + 8
+      || memcmp (seg->data, "Exif\0\0", 6) != 0)
+    return FALSE;
+
+  *tiff = seg->data + 6;
+  *tiff_size = seg->length - 6;
+  if ((*tiff)[0] == 'M' && (*tiff)[1] == 'M')
+    *big_endian = TRUE;
+  else if ((*tiff)[0] == 'I' && (*tiff)[1] == 'I')
+    *big_endian = FALSE;
+  else
+    return FALSE;
+  if (exif_read_16 (*tiff + 2, *big_endian) != 42)
+    return FALSE;
+
+  *ifd = exif_read_32 (*tiff + 4, *big_endian);
+  return *ifd <= *tiff_size - 2;
+}
+
+gboolean
+gst_jpeg_segment_is_exif (const GstJpegSegment * seg)
+{
+  return seg->marker == JPEG_MARKER_APP1 && seg->length >= 6
+      && memcmp (seg->data, "Exif\0\0", 6) == 0;
+}
+
+/**
+ * gst_jpeg_find_exif_orientation:
+ *
+ * Looks up the Orientation entry of IFD0 in the EXIF APP1 segment of the
+ * header. Returns %FALSE when there is none, otherwise @orientation holds
+ * its value and where to overwrite it.
+ */
+gboolean
+gst_jpeg_find_exif_orientation (const guint8 * data, gsize size,
+    GstJpegExifOrientation * orientation)
+{
+  GstJpegSegment seg;
+  gsize offset = 2;
+
+  if (size < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI)
+    return FALSE;
+
+  while (gst_jpeg_next_segment (data, size, &offset, &seg)) {
+    const guint8 *tiff;
+    gboolean big_endian;
+    guint32 ifd, i, n_entries;
+    guint tiff_size;
+
+    if (!gst_jpeg_segment_is_exif (&seg))
+      continue;
+    if (!exif_parse_header (&seg, &tiff, &tiff_size, &big_endian, &ifd))
+      return FALSE;
+    n_entries = exif_read_16 (tiff + ifd, big_endian);
+
+    for (i = 0; i < n_entries; i++) {
+      const guint8 *entry = tiff + ifd + 2 + 12 * i;
+
+      if (ifd + 2 + 12 * (i + 1) > tiff_size)
+        return FALSE;
+      if (exif_read_16 (entry, big_endian) != EXIF_TAG_ORIENTATION)
+        continue;
+      if (exif_read_16 (entry + 2, big_endian) != EXIF_TYPE_SHORT)
+        return FALSE;
+
+      orientation->offset = entry + 8 - data;
+      orientation->big_endian = big_endian;
+      orientation->value = exif_read_16 (entry + 8, big_endian);
+      return TRUE;
+    }
+    return FALSE;
+  }
+
+  return FALSE;
+}
+
+void
+gst_jpeg_write_exif_orientation (guint8 * data,
+    const GstJpegExifOrientation * orientation, guint value)
+{
+  if (orientation->big_endian)
+    GST_WRITE_UINT16_BE (data + orientation->offset, value);
+  else
+    GST_WRITE_UINT16_LE (data + orientation->offset, value);
+}
+
+/**
+ * gst_jpeg_write_exif_orientation_segment:
+ *
+ * Writes a complete big endian EXIF APP1 segment of
+ * %JPEG_EXIF_ORIENTATION_SEGMENT_SIZE bytes to @data, with a single
+ * Orientation entry of @value.
+ */
+void
+gst_jpeg_write_exif_orientation_segment (guint8 * data, guint value)
+{
+  guint8 *tiff = data + 10;
+
+  data[0] = 0xFF;
+  data[1] = JPEG_MARKER_APP1;
+  GST_WRITE_UINT16_BE (data + 2, JPEG_EXIF_ORIENTATION_SEGMENT_SIZE - 2);
+  memcpy (data + 4, "Exif\0\0", 6);
+
+  memcpy (tiff, "MM\0\x2a", 4);
+  GST_WRITE_UINT32_BE (tiff + 4, 8);
+  GST_WRITE_UINT16_BE (tiff + 8, 1);
+  GST_WRITE_UINT16_BE (tiff + 10, EXIF_TAG_ORIENTATION);
+  GST_WRITE_UINT16_BE (tiff + 12, EXIF_TYPE_SHORT);
+  GST_WRITE_UINT32_BE (tiff + 14, 1);
+  GST_WRITE_UINT16_BE (tiff + 18, value);
+  GST_WRITE_UINT16_BE (tiff + 20, 0);
+  /* no IFD1 */
+  GST_WRITE_UINT32_BE (tiff + 22, 0);
+}
+
+/**
+ * gst_jpeg_exif_add_orientation_size:
+ *
+ * How many bytes gst_jpeg_write_exif_add_orientation() adds to the EXIF
+ * APP1 segment @seg, or 0 when it cannot: @seg is malformed, its IFD0
+ * already has an Orientation entry or it would outgrow 64 KiB.
+ */
+guint
+gst_jpeg_exif_add_orientation_size (const GstJpegSegment * seg)
+{
+  const guint8 *tiff;
+  gboolean big_endian;
+  guint32 ifd, i, n_entries;
+  guint tiff_size, added;
+
+  if (!exif_parse_header (seg, &tiff, &tiff_size, &big_endian, &ifd))
+    return 0;
+  n_entries = exif_read_16 (tiff + ifd, big_endian);
+  if (n_entries >= G_MAXUINT16 || ifd + 2 + 12 * n_entries + 4 > tiff_size)
+    return 0;
+  for (i = 0; i < n_entries; i++)
+    if (exif_read_16 (tiff + ifd + 2 + 12 * i, big_endian) ==
+        EXIF_TAG_ORIENTATION)
+      return 0;
+
+  /* the copy starts on a word boundary */
+  added = (tiff_size & 1) + 2 + 12 * (n_entries + 1) + 4;
+  if (seg->length + 2 + added > G_MAXUINT16)
+    return 0;
+
+  return added;
+}
+
+/**
+ * gst_jpeg_write_exif_add_orientation:
+ *
+ * Writes @seg to @data with a copy of its IFD0 appended, which has an
+ * Orientation entry of @value in tag order, and points the TIFF header
+ * at the copy. Nothing else moves, so every offset in the segment stays
+ * valid. @seg has to pass gst_jpeg_exif_add_orientation_size(), which
+ * also tells how much more than @seg->size is written. @data starts
+ * with the marker.
+ */
+void
+gst_jpeg_write_exif_add_orientation (guint8 * data,
+    const GstJpegSegment * seg, guint value)
+{
+  guint added = gst_jpeg_exif_add_orientation_size (seg);
+  const guint8 *tiff = seg->data + 6;
+  gboolean big_endian = tiff[0] == 'M';
+  guint32 ifd, copy, i, n_entries;
+  guint tiff_size = seg->length - 6;
+  guint8 *out, *entry;
+
+  data[0] = 0xFF;
+  data[1] = JPEG_MARKER_APP1;
+  GST_WRITE_UINT16_BE (data + 2, seg->length + 2 + added);
+  memcpy (data + 4, seg->data, seg->length);
+  out = data + 4 + 6;
+
+  ifd = exif_read_32 (tiff + 4, big_endian);
+  n_entries = exif_read_16 (tiff + ifd, big_endian);
+  copy = tiff_size + (tiff_size & 1);
+  out[tiff_size] = 0;
+
+  entry = out + copy + 2;
+  for (i = 0; i < n_entries; i++) {
+    const guint8 *src = tiff + ifd + 2 + 12 * i;
+
+    if (exif_read_16 (src, big_endian) > EXIF_TAG_ORIENTATION)
+      break;
+    memcpy (entry, src, 12);
+    entry += 12;
+  }
+
+  memset (entry, 0, 12);
+  if (big_endian) {
+    GST_WRITE_UINT16_BE (out + copy, n_entries + 1);
+    GST_WRITE_UINT32_BE (out + 4, copy);
+    GST_WRITE_UINT16_BE (entry, EXIF_TAG_ORIENTATION);
+    GST_WRITE_UINT16_BE (entry + 2, EXIF_TYPE_SHORT);
+    GST_WRITE_UINT32_BE (entry + 4, 1);
+    GST_WRITE_UINT16_BE (entry + 8, value);
+  } else {
+    GST_WRITE_UINT16_LE (out + copy, n_entries + 1);
+    GST_WRITE_UINT32_LE (out + 4, copy);
+    GST_WRITE_UINT16_LE (entry, EXIF_TAG_ORIENTATION);
+    GST_WRITE_UINT16_LE (entry + 2, EXIF_TYPE_SHORT);
+    GST_WRITE_UINT32_LE (entry + 4, 1);
+    GST_WRITE_UINT16_LE (entry + 8, value);
+  }
+  entry += 12;
+
+  /* the rest of the entries and the IFD1 offset */
+  memcpy (entry, tiff + ifd + 2 + 12 * i, 12 * (n_entries - i) + 4);
+}
+
+/**
+ * gst_jpeg_next_marker:
+ *
+ * Finds the next marker at or after @offset in entropy-coded data,
+ * skipping stuffed 0xFF00 bytes and fill bytes. Returns the offset of
+ * the marker's 0xFF and stores the marker code in @marker, or returns
+ * @size when there is none.
+ */
+gsize
+gst_jpeg_next_marker (const guint8 * data, gsize size, gsize offset,
+    guint8 * marker)
+{
+  while (offset + 1 < size) {
+    const guint8 *p = memchr (data + offset, 0xFF, size - offset - 1);
+
+    if (p == NULL)
+      break;
+    offset = p - data;
+    if (data[offset + 1] != 0x00 && data[offset + 1] != 0xFF) {
+      if (marker)
+        *marker = data[offset + 1];
+      return offset;
+    }
+    offset++;
+  }
+
+  return size;
+}
+
+/* GstJpegFramer */
+
+enum
+{
+  FRAMER_SYNC,                  /* looking for SOI */
+  FRAMER_SYNC_FF,
+  FRAMER_MARKER,                /* expecting the next header marker */
+  FRAMER_MARKER_CODE,
+  FRAMER_LENGTH_HI,
+  FRAMER_LENGTH_LO,
+  FRAMER_SKIP,                  /* inside a marker segment */
+  FRAMER_ENTROPY,               /* inside entropy-coded data */
+  FRAMER_ENTROPY_FF
+};
+
+void
+gst_jpeg_framer_reset (GstJpegFramer * framer)
+{
+  memset (framer, 0, sizeof (*framer));
+  framer->state = FRAMER_SYNC;
+}
+
+/* between an SOI and its EOI */
+gboolean
+gst_jpeg_framer_in_image (const GstJpegFramer * framer)
+{
+  return framer->state != FRAMER_SYNC && framer->state != FRAMER_SYNC_FF;
+}
+
+/**
+ * gst_jpeg_framer_scan:
+ *
+ * Feeds @size bytes of the stream to @framer. Returns how many of them
+ * were consumed, which is less than @size only when an SOI or EOI was
+ * found; @event then tells which, and the marker ends the consumed part.
+ * Marker segments are skipped by their length, so thumbnails in EXIF
+ * data do not end the image, and entropy-coded data is searched with
+ * memchr().
+ */
+gsize
+gst_jpeg_framer_scan (GstJpegFramer * framer, const guint8 * data,
+    gsize size, GstJpegFramerEvent * event)
+{
+  gsize i = 0;
+
+  *event = GST_JPEG_FRAMER_NONE;
+
+  while (i < size) {
+    const guint8 *p;
+    gsize n;
+    guint8 b;
+
+    switch (framer->state) {
+      case FRAMER_SYNC:
+      case FRAMER_ENTROPY:
+        p = memchr (data + i, 0xFF, size - i);
+        if (p == NULL)
+          return size;
+        i = p - data + 1;
+        framer->state = framer->state == FRAMER_SYNC ? FRAMER_SYNC_FF :
+            FRAMER_ENTROPY_FF;
+        continue;
+      case FRAMER_SKIP:
+        n = MIN (framer->skip, size - i);
+        i += n;
+        framer->skip -= n;
+        if (framer->skip == 0)
+          framer->state = framer->marker == JPEG_MARKER_SOS ?
+              FRAMER_ENTROPY : FRAMER_MARKER;
+        continue;
+      default:
+        break;
+    }
+
+    b = data[i++];
+    switch (framer->state) {
+      case FRAMER_SYNC_FF:
+        if (b == JPEG_MARKER_SOI) {
+          framer->state = FRAMER_MARKER;
+          *event = GST_JPEG_FRAMER_SOI;
+          return i;
+        }
+        if (b != 0xFF)
+          framer->state = FRAMER_SYNC;
+        break;
+      case FRAMER_MARKER:
+        framer->state = b == 0xFF ? FRAMER_MARKER_CODE : FRAMER_SYNC;
+        break;
+      case FRAMER_MARKER_CODE:
+      case FRAMER_ENTROPY_FF:
+        if (b == 0xFF)
+          break;
+        if (b == JPEG_MARKER_SOI) {
+          /* the image before was cut short */
+          framer->state = FRAMER_MARKER;
+          *event = GST_JPEG_FRAMER_SOI;
+          return i;
+        }
+        if (b == JPEG_MARKER_EOI) {
+          framer->state = FRAMER_SYNC;
+          *event = GST_JPEG_FRAMER_EOI;
+          return i;
+        }
+        if (b == 0x00) {
+          /* stuffed byte, or garbage in the header */
+          framer->state = framer->state == FRAMER_ENTROPY_FF ?
+              FRAMER_ENTROPY : FRAMER_SYNC;
+        } else if (JPEG_MARKER_IS_RST (b) || b == 0x01) {
+          /* no length field */
+          framer->state = framer->state == FRAMER_ENTROPY_FF ?
+              FRAMER_ENTROPY : FRAMER_MARKER;
+        } else {
+          /* DHT, SOS and so on between the scans of progressive images */
+          framer->marker = b;
+          framer->state = FRAMER_LENGTH_HI;
+        }
+        break;
+      case FRAMER_LENGTH_HI:
+        framer->length = b << 8;
+        framer->state = FRAMER_LENGTH_LO;
+        break;
+      case FRAMER_LENGTH_LO:
+        framer->length |= b;
+        if (framer->length < 2) {
+          framer->state = FRAMER_SYNC;
+        } else if (framer->length > 2) {
+          framer->skip = framer->length - 2;
+          framer->state = FRAMER_SKIP;
+        } else {
+          framer->state = framer->marker == JPEG_MARKER_SOS ?
+              FRAMER_ENTROPY : FRAMER_MARKER;
+        }
+        break;
+      default:
+        g_assert_not_reached ();
+        break;
+    }
+  }
+
+  return size;
+}
@@ -0,0 +1,171 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_JPEG_MARKERS_H__
+#define __GST_JPEG_MARKERS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOF1 0xC1
+#define JPEG_MARKER_SOF2 0xC2
+#define JPEG_MARKER_DHT  0xC4
+#define JPEG_MARKER_JPG  0xC8
+#define JPEG_MARKER_DAC  0xCC
+#define JPEG_MARKER_SOF15 0xCF
+#define JPEG_MARKER_RST0 0xD0
+#define JPEG_MARKER_RST7 0xD7
+#define JPEG_MARKER_SOI  0xD8
+#define JPEG_MARKER_EOI  0xD9
+#define JPEG_MARKER_SOS  0xDA
+#define JPEG_MARKER_DQT  0xDB
+#define JPEG_MARKER_DRI  0xDD
+#define JPEG_MARKER_APP0 0xE0
+#define JPEG_MARKER_APP1 0xE1
+#define JPEG_MARKER_APP2 0xE2
+#define JPEG_MARKER_APP14 0xEE
+#define JPEG_MARKER_APP15 0xEF
+#define JPEG_MARKER_COM  0xFE
+
+#define JPEG_MARKER_IS_RST(m) ((m) >= JPEG_MARKER_RST0 && (m) <= JPEG_MARKER_RST7)
+#define JPEG_MARKER_IS_SOF(m) ((m) >= JPEG_MARKER_SOF0 && \
+    (m) <= JPEG_MARKER_SOF15 && (m) != JPEG_MARKER_DHT && \
+    (m) != JPEG_MARKER_JPG && (m) != JPEG_MARKER_DAC)
+
+#define JPEG_MAX_COMPONENTS 4
+
+/* what a JPEG says about itself up to the first SOS, offsets point at the
+ * 0xFF of the respective marker */
+typedef struct
+{
+  guint8 sof_marker;
+  guint16 width, height;
+  guint8 n_components;
+  guint8 h_samp[JPEG_MAX_COMPONENTS], v_samp[JPEG_MAX_COMPONENTS];
+  guint8 max_h_samp, max_v_samp;
+  guint8 scan_components;
+  guint16 restart_interval;
+
+  gsize sof_offset;
+  gsize dri_offset;             /* 0 when there is no DRI */
+  gsize sos_offset;
+  gsize scan_offset;            /* first byte of entropy-coded data */
+} GstJpegFrameInfo;
+
+/* one marker segment of the header, offset points at its 0xFF and size
+ * covers the marker and length field */
+typedef struct
+{
+  guint8 marker;
+  gsize offset;
+  gsize size;
+  const guint8 *data;
+  guint length;                 /* bytes at data */
+} GstJpegSegment;
+
+gboolean gst_jpeg_next_segment (const guint8 * data, gsize size,
+    gsize * offset, GstJpegSegment * seg);
+
+gboolean gst_jpeg_parse_frame_info (const guint8 * data, gsize size,
+    GstJpegFrameInfo * info);
+
+gboolean gst_jpeg_frame_info_is_baseline (const GstJpegFrameInfo * info);
+
+guint gst_jpeg_frame_info_mcu_width (const GstJpegFrameInfo * info);
+guint gst_jpeg_frame_info_mcu_height (const GstJpegFrameInfo * info);
+guint gst_jpeg_frame_info_mcus_per_row (const GstJpegFrameInfo * info);
+
+/* where the IFD0 Orientation entry of an EXIF APP1 segment keeps its
+ * value */
+typedef struct
+{
+  gsize offset;
+  gboolean big_endian;
+  guint value;
+} GstJpegExifOrientation;
+
+gboolean gst_jpeg_find_exif_orientation (const guint8 * data, gsize size,
+    GstJpegExifOrientation * orientation);
+void gst_jpeg_write_exif_orientation (guint8 * data,
+    const GstJpegExifOrientation * orientation, guint value);
+
+/* an APP1 segment with nothing but IFD0 Orientation */
+#define JPEG_EXIF_ORIENTATION_SEGMENT_SIZE 36
+
+void gst_jpeg_write_exif_orientation_segment (guint8 * data, guint value);
+
+gboolean gst_jpeg_segment_is_exif (const GstJpegSegment * seg);
+guint gst_jpeg_exif_add_orientation_size (const GstJpegSegment * seg);
+void gst_jpeg_write_exif_add_orientation (guint8 * data,
+    const GstJpegSegment * seg, guint value);
+
+gsize gst_jpeg_next_marker (const guint8 * data, gsize size, gsize offset,
+    guint8 * marker);
+
+/* finds the images in a byte stream that may split or pack them in any
+ * way, fed one chunk after the other */
+typedef enum
+{
+  GST_JPEG_FRAMER_NONE,
+  GST_JPEG_FRAMER_SOI,          /* the chunk up to here ends with an SOI */
+  GST_JPEG_FRAMER_EOI           /* the chunk up to here ends with an EOI */
+} GstJpegFramerEvent;
+
+typedef struct
+{
+  guint state;
+  guint8 marker;
+  guint length;
+  gsize skip;
+} GstJpegFramer;
+
+void gst_jpeg_framer_reset (GstJpegFramer * framer);
+gboolean gst_jpeg_framer_in_image (const GstJpegFramer * framer);
+gsize gst_jpeg_framer_scan (GstJpegFramer * framer, const guint8 * data,
+    gsize size, GstJpegFramerEvent * event);
+
+G_END_DECLS
+
+#endif /* __GST_JPEG_MARKERS_H__ */
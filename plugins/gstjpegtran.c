@@ -53,6 +53,26 @@
  * |[
  * gst-launch-1.0 videotestsrc is-live=true ! jpegenc ! jpegtran xop=rot180 ! jpegdec ! aasink
  * ]|
+ * |[
+ * gst-launch-1.0 videotestsrc is-live=true ! jpegenc ! jpegtran crop-x=64 crop-y=32 crop-width=160 crop-height=120 ! jpegdec ! aasink
+ * ]|
+ * Crops without decoding. The region is moved to the MCU grid and can be
+ * changed while playing, also with a GstJpegTranCrop upstream event.
+ * |[
+ * gst-launch-1.0 filesrc location=photo.jpg ! jpegparse ! jpegtran xop=auto ! filesink location=upright.jpg
+ * ]|
+ * Rotates according to the EXIF orientation and resets it to normal.
+ * |[
+ * gst-launch-1.0 tcpclientsrc host=camera port=5000 ! image/jpeg,parsed=false,framerate=25/1 ! jpegtran xop=hflip ! jpegdec ! autovideosink
+ * ]|
+ * Input with parsed=false is a byte stream that jpegtran cuts into
+ * images itself, however they are split across or packed into the
+ * buffers. Without parsed in the caps that starts with the first buffer
+ * that does not hold exactly one image.
+ *
+ * The xop can change on an exact frame with a serialized
+ * "GstJpegTranXop, xop=rot90" custom downstream event, or be picked for
+ * each buffer with a "GstJpegTranMeta" custom meta holding an xop field.
  * </refsect2>
  */
 
@@ -61,8 +81,12 @@
 #endif
 
 #include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <stdio.h>
+#include <string.h>
 #include <turbojpeg.h>
 #include "gstjpegtran.h"
+#include "gstjpegmarkers.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_jpegtran_debug);
 #define GST_CAT_DEFAULT gst_jpegtran_debug
@@ -70,7 +94,39 @@ GST_DEBUG_CATEGORY_STATIC (gst_jpegtran_debug);
 enum
 {
   PROP_0,
-  PROP_XOP
+  PROP_XOP,
+  PROP_CROP_X,
+  PROP_CROP_Y,
+  PROP_CROP_WIDTH,
+  PROP_CROP_HEIGHT,
+  PROP_GRAY,
+  PROP_PROGRESSIVE,
+  PROP_OPTIMIZE,
+  PROP_COPY_MARKERS,
+  PROP_MARKER_LIST,
+  PROP_VIRTUAL_ROTATION,
+  PROP_OPS,
+  PROP_BYTES_SAVED,
+  PROP_CODING_TIME,
+  PROP_PREDICT_HITS,
+  PROP_PREDICT_MISSES,
+  PROP_N_THREADS,
+  PROP_N_STRIPE_THREADS,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_OUTPUT_QUEUE_FRAMES,
+  PROP_OUTPUT_QUEUE_BYTES
+};
+
+enum
+{
+  PROP_PAD_0,
+  PROP_PAD_XOP,
+  PROP_PAD_CROP_X,
+  PROP_PAD_CROP_Y,
+  PROP_PAD_CROP_WIDTH,
+  PROP_PAD_CROP_HEIGHT,
+  PROP_PAD_GRAY
 };
 
 /* the capabilities of the inputs and outputs.
@@ -89,13 +145,124 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
     GST_STATIC_CAPS ("image/jpeg")
     );
 
+/* extra outputs transformed in the same tjTransform() call */
+static GstStaticPadTemplate src_request_factory =
+GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("image/jpeg")
+    );
+
+static void gst_jpegtran_child_proxy_init (gpointer g_iface,
+    gpointer iface_data);
+
 #define gst_jpegtran_parent_class parent_class
-G_DEFINE_TYPE (Gstjpegtran, gst_jpegtran, GST_TYPE_ELEMENT);
+G_DEFINE_TYPE_WITH_CODE (Gstjpegtran, gst_jpegtran, GST_TYPE_BASE_TRANSFORM,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_CHILD_PROXY,
+        gst_jpegtran_child_proxy_init));
+
+G_DEFINE_TYPE (GstJpegTranPad, gst_jpegtran_pad, GST_TYPE_PAD);
 
 GST_ELEMENT_REGISTER_DEFINE (jpegtran, "jpegtran", GST_RANK_NONE,
     GST_TYPE_JPEGTRAN);
 
 #define DEFAULT_XOP TJXOP_NONE
+#define DEFAULT_GRAY FALSE
+#define DEFAULT_PROGRESSIVE FALSE
+#define DEFAULT_OPTIMIZE FALSE
+#define DEFAULT_VIRTUAL_ROTATION FALSE
+#define DEFAULT_OPS NULL
+#define DEFAULT_COPY_MARKERS GST_JPEGTRAN_COPY_MARKERS_ALL
+#define DEFAULT_MARKER_LIST NULL
+
+/* bits of marker_mask, APPn is bit n */
+#define MARKER_MASK_COM (1 << 16)
+
+/* Huffman table optimization is a transform option since libjpeg-turbo
+ * 3.0, progressive output always gets optimized tables */
+#ifdef TJXOPT_OPTIMIZE
+#define ENTROPY_OPTIONS (TJXOPT_PROGRESSIVE | TJXOPT_OPTIMIZE)
+#else
+#define ENTROPY_OPTIONS TJXOPT_PROGRESSIVE
+#endif
+
+/* output/input size ratio assumed before the first frame, re-encoding
+ * with the standard Huffman tables usually grows the data a bit */
+#define DEFAULT_RATIO 1.25
+/* headroom on top of the predicted size */
+#define PREDICT_MARGIN (1.0 / 16)
+/* room for tables and markers that do not scale with the image */
+#define PREDICT_SLACK 2048
+/* how fast the ratio follows shrinking frames */
+#define PREDICT_DECAY 0.05
+
+#define DEFAULT_STATS_INTERVAL 0
+
+#define DEFAULT_N_THREADS 1
+/* frames in flight per worker before the streaming thread waits */
+#define JOBS_PER_WORKER 2
+
+/* the output of one request pad for one frame */
+typedef struct
+{
+  GstJpegTranPad *pad;
+  tjtransform xform;
+  GstBuffer *outbuf;
+} GstJpegTranOutput;
+
+/* the transform of the always src pad for one frame, taken when the
+ * frame comes in so that later changes do not reach it */
+typedef struct
+{
+  tjtransform xform;
+  /* the ops list to place on the frame, or NULL */
+  GArray *ops;
+} GstJpegTranConfig;
+
+/* a frame handed to the workers, kept in input order in self->pending */
+typedef struct
+{
+  GstJpegTranTask task;
+  GstBuffer *inbuf;
+  GstBuffer *outbuf;
+  GstJpegTranConfig config;
+  GstJpegTranOutput *extra;
+  guint n_extra;
+  /* GST_BASE_TRANSFORM_FLOW_DROPPED when it was late for a worker */
+  GstFlowReturn ret;
+  gboolean done;
+  GstClockTime pts, duration, running_time;
+} GstJpegTranJob;
+
+#define DEFAULT_OUTPUT_QUEUE_FRAMES 0
+#define DEFAULT_OUTPUT_QUEUE_BYTES 0
+/* slots of an output queue bounded in bytes only */
+#define OUTPUT_QUEUE_SLOTS 1024
+
+#define DEFAULT_N_STRIPE_THREADS 1
+/* smaller images are not worth splitting */
+#define STRIPE_MIN_PIXELS (1 << 20)
+
+/* restart-interval stripes of one frame, transformed by the stripe pool */
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  guint pending;
+} GstJpegTranStripeBatch;
+
+typedef struct
+{
+  GstJpegTranTask task;
+  GstJpegTranStripeBatch *batch;
+  tjtransform xform;
+  guint8 *in;
+  gsize in_size;
+  unsigned char *out;
+  unsigned long out_size;
+  GstJpegFrameInfo out_info;
+  gboolean ok;
+} GstJpegTranStripe;
 #define GST_TYPE_JPEGTRAN_XOP (gst_jpegtran_xop_get_type ())
 static GType
 gst_jpegtran_xop_get_type (void)
@@ -110,6 +277,8 @@ gst_jpegtran_xop_get_type (void)
     {TJXOP_ROT90, "Rotate image clockwise by 90 degrees.", "rot90"},
     {TJXOP_ROT180, "Rotate image clockwise by 180 degrees.", "rot180"},
     {TJXOP_ROT270, "Rotate image clockwise by 270 degrees.", "rot270"},
+    {GST_JPEGTRAN_XOP_AUTO, "Make the image upright according to its EXIF "
+        "orientation or image-orientation tag", "auto"},
     {0, NULL, NULL}
   };
   if (!jpegtran_xop_type) {
@@ -119,264 +288,4320 @@ gst_jpegtran_xop_get_type (void)
   return jpegtran_xop_type;
 }
 
-static void gst_jpegtran_set_property (GObject * object,
-    guint prop_id, const GValue * value, GParamSpec * pspec);
-static void gst_jpegtran_get_property (GObject * object,
-    guint prop_id, GValue * value, GParamSpec * pspec);
+#define GST_TYPE_JPEGTRAN_COPY_MARKERS (gst_jpegtran_copy_markers_get_type ())
+static GType
+gst_jpegtran_copy_markers_get_type (void)
+{
+  static GType copy_markers_type = 0;
+  static const GEnumValue copy_markers[] = {
+    {GST_JPEGTRAN_COPY_MARKERS_ALL, "Copy all APPn and COM markers", "all"},
+    {GST_JPEGTRAN_COPY_MARKERS_NONE, "Copy no extra markers", "none"},
+    {GST_JPEGTRAN_COPY_MARKERS_ICC, "Copy only the ICC profile",
+        "icc-only"},
+    {GST_JPEGTRAN_COPY_MARKERS_CUSTOM, "Copy the markers in marker-list",
+        "custom"},
+    {0, NULL, NULL}
+  };
+
+  if (!copy_markers_type) {
+    copy_markers_type =
+        g_enum_register_static ("GstJpegTranCopyMarkers", copy_markers);
+  }
+  return copy_markers_type;
+}
 
-static gboolean gst_jpegtran_sink_event (GstPad * pad,
-    GstObject * parent, GstEvent * event);
-static GstFlowReturn gst_jpegtran_chain (GstPad * pad,
-    GstObject * parent, GstBuffer * buf);
+static gboolean
+gst_jpegtran_xop_is_transposing (GstJpegTranXop xop)
+{
+  return xop == TJXOP_TRANSPOSE || xop == TJXOP_TRANSVERSE ||
+      xop == TJXOP_ROT90 || xop == TJXOP_ROT270;
+}
 
-/* GObject vmethod implementations */
+/* a custom upstream event moves the crop region without going through
+ * the properties, e.g. for digital pan:
+ *
+ *   GstJpegTranCrop, x=(int)320, y=(int)240
+ *
+ * fields that are left out keep their current value */
+#define GST_JPEGTRAN_CROP_EVENT "GstJpegTranCrop"
 
-/* initialize the jpegtran's class */
-static void
-gst_jpegtran_class_init (GstjpegtranClass * klass)
+static gboolean
+gst_jpegtran_handle_crop_event (GObject * object, GstEvent * event)
 {
-  GObjectClass *gobject_class;
-  GstElementClass *gstelement_class;
+  static const gchar *fields[] = { "x", "y", "width", "height" };
+  static const gchar *props[] = { "crop-x", "crop-y", "crop-width",
+    "crop-height"
+  };
+  const GstStructure *s;
+  guint i;
+  gint v;
 
-  gobject_class = (GObjectClass *) klass;
-  gstelement_class = (GstElementClass *) klass;
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_UPSTREAM
+      || !gst_event_has_name (event, GST_JPEGTRAN_CROP_EVENT))
+    return FALSE;
 
-  gobject_class->set_property = gst_jpegtran_set_property;
-  gobject_class->get_property = gst_jpegtran_get_property;
-  gobject_class->finalize = gst_jpegtran_finalize;
+  s = gst_event_get_structure (event);
+  GST_DEBUG_OBJECT (object, "crop event %" GST_PTR_FORMAT, s);
 
-  g_object_class_install_property (gobject_class, PROP_XOP,
-      g_param_spec_enum ("xop", "transform",
-          "Transform opertation to perform", GST_TYPE_JPEGTRAN_XOP,
-          DEFAULT_XOP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_freeze_notify (object);
+  for (i = 0; i < G_N_ELEMENTS (fields); i++) {
+    if (gst_structure_get_int (s, fields[i], &v))
+      g_object_set (object, props[i], MAX (v, 0), NULL);
+  }
+  g_object_thaw_notify (object);
 
-  gst_element_class_set_details_simple (gstelement_class,
-					"Losslessly transform a JPEG image into another JPEG image",
-					"Filter Image",
-					"Rearranges the compressed data (DCT coefficients) using libturbojpeg without ever fully decoding the image.",
-					"Petri Ahonen <peahonen@gmail.com>");
+  return TRUE;
+}
 
-  gst_element_class_add_pad_template (gstelement_class,
-      gst_static_pad_template_get (&src_factory));
-  gst_element_class_add_pad_template (gstelement_class,
-      gst_static_pad_template_get (&sink_factory));
+/* The transform of the always src pad can follow the stream:
+ *
+ * a serialized custom downstream event sets xop from the next buffer on,
+ *
+ *   GstJpegTranXop, xop=rot90
+ *
+ * and a GstJpegTranMeta custom meta with the same field picks the xop of
+ * a single buffer, in place of xop or ops. crop-* still apply. The meta
+ * is registered with the element class, applications add it with
+ * gst_buffer_add_custom_meta (buffer, "GstJpegTranMeta"). */
+#define GST_JPEGTRAN_XOP_EVENT "GstJpegTranXop"
+#define GST_JPEGTRAN_META "GstJpegTranMeta"
 
-  GST_DEBUG_CATEGORY_INIT (gst_jpegtran_debug, "jpegtran", 0,
-			   "jpegtran");
+/* xop as a nick, enum or int field */
+static gboolean
+gst_jpegtran_structure_get_xop (const GstStructure * s, GstJpegTranXop * xop)
+{
+  const gchar *nick = gst_structure_get_string (s, "xop");
+  gint v;
+
+  if (nick != NULL) {
+    GEnumClass *xop_class = g_type_class_ref (GST_TYPE_JPEGTRAN_XOP);
+    GEnumValue *value = g_enum_get_value_by_nick (xop_class, nick);
+
+    v = value ? value->value : -1;
+    g_type_class_unref (xop_class);
+  } else if (!gst_structure_get_enum (s, "xop", GST_TYPE_JPEGTRAN_XOP, &v)
+      && !gst_structure_get_int (s, "xop", &v)) {
+    return FALSE;
+  }
 
+  if (v < 0 || v > GST_JPEGTRAN_XOP_AUTO)
+    return FALSE;
+  *xop = v;
+
+  return TRUE;
 }
 
-/* initialize the new element
- * instantiate pads and add them to element
- * set pad callback functions
- * initialize instance structure
- */
+static gboolean
+gst_jpegtran_buffer_get_xop (GstBuffer * buf, GstJpegTranXop * xop)
+{
+  GstCustomMeta *meta = gst_buffer_get_custom_meta (buf, GST_JPEGTRAN_META);
+
+  return meta != NULL
+      && gst_jpegtran_structure_get_xop (gst_custom_meta_get_structure (meta),
+      xop);
+}
+
+/* the transform asked for is done, the output must not carry it on */
 static void
-gst_jpegtran_init (Gstjpegtran * filter)
+gst_jpegtran_remove_meta (GstBuffer * buf)
 {
-  filter->sinkpad = gst_pad_new_from_static_template (&sink_factory, "sink");
-  gst_pad_set_event_function (filter->sinkpad,
-      GST_DEBUG_FUNCPTR (gst_jpegtran_sink_event));
-  gst_pad_set_chain_function (filter->sinkpad,
-      GST_DEBUG_FUNCPTR (gst_jpegtran_chain));
-  GST_PAD_SET_PROXY_CAPS (filter->sinkpad);
-  gst_element_add_pad (GST_ELEMENT (filter), filter->sinkpad);
+  GstCustomMeta *meta = gst_buffer_get_custom_meta (buf, GST_JPEGTRAN_META);
 
-  filter->srcpad = gst_pad_new_from_static_template (&src_factory, "src");
-  GST_PAD_SET_PROXY_CAPS (filter->srcpad);
-  gst_element_add_pad (GST_ELEMENT (filter), filter->srcpad);
+  if (meta != NULL)
+    gst_buffer_remove_meta (buf, (GstMeta *) meta);
+}
 
-  filter->xop = DEFAULT_XOP;
+static gboolean
+gst_jpegtran_handle_xop_event (GObject * object, GstEvent * event)
+{
+  GstJpegTranXop xop;
 
-  filter->tjHandle = tjInitDecompress();
-  if( filter->tjHandle == NULL) {
-    GST_ELEMENT_ERROR (filter, STREAM, WRONG_TYPE, ("cannot init decompressor"),
-        (NULL));
-    // TODO
+  if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_DOWNSTREAM
+      || !gst_event_has_name (event, GST_JPEGTRAN_XOP_EVENT))
+    return FALSE;
+
+  GST_DEBUG_OBJECT (object, "xop event %" GST_PTR_FORMAT,
+      gst_event_get_structure (event));
+
+  if (gst_jpegtran_structure_get_xop (gst_event_get_structure (event), &xop))
+    g_object_set (object, "xop", xop, NULL);
+  else
+    GST_WARNING_OBJECT (object, "xop event without a valid xop");
+
+  return TRUE;
+}
+
+/* xops are composed as rotate(r) after hflip(f), coded f * 4 + r and
+ * indexed by GstJpegTranXop */
+
+static const guint8 xop_codes[] = { 0, 4, 6, 7, 5, 1, 2, 3 };
+static const GstJpegTranXop code_xops[] = {
+  TJXOP_NONE, TJXOP_ROT90, TJXOP_ROT180, TJXOP_ROT270,
+  TJXOP_HFLIP, TJXOP_TRANSVERSE, TJXOP_VFLIP, TJXOP_TRANSPOSE
+};
+
+/* a after b */
+static GstJpegTranXop
+gst_jpegtran_compose_xop (GstJpegTranXop a, GstJpegTranXop b)
+{
+  guint fa = xop_codes[a] >> 2, ra = xop_codes[a] & 3;
+  guint fb = xop_codes[b] >> 2, rb = xop_codes[b] & 3;
+
+  /* hflip after rotate(r) is rotate(-r) after hflip */
+  return code_xops[((fa ^ fb) << 2) | ((ra + (fa ? 4 - rb : rb)) & 3)];
+}
+
+/* ops, a list of transforms collapsed into one xop and crop region */
+
+typedef struct
+{
+  gboolean is_crop;
+  GstJpegTranXop xop;
+  tjregion crop;
+} GstJpegTranOp;
+
+/* "rot90, hflip, crop=0:0:640:480" */
+static GArray *
+gst_jpegtran_parse_ops (Gstjpegtran * self, const gchar * list)
+{
+  GArray *ops = g_array_new (FALSE, FALSE, sizeof (GstJpegTranOp));
+  GEnumClass *xop_class;
+  gchar **names;
+  guint i;
+
+  if (list == NULL)
+    return ops;
+
+  xop_class = g_type_class_ref (GST_TYPE_JPEGTRAN_XOP);
+  names = g_strsplit (list, ",", -1);
+  for (i = 0; names[i] != NULL; i++) {
+    gchar *name = g_strstrip (names[i]);
+    GEnumValue *value;
+    GstJpegTranOp op = { 0, };
+
+    if (*name == '\0')
+      continue;
+
+    if (sscanf (name, "crop=%d:%d:%d:%d", &op.crop.x, &op.crop.y,
+            &op.crop.w, &op.crop.h) == 4 && op.crop.x >= 0 && op.crop.y >= 0
+        && op.crop.w >= 0 && op.crop.h >= 0) {
+      op.is_crop = TRUE;
+      g_array_append_val (ops, op);
+      continue;
+    }
+
+    value = g_enum_get_value_by_nick (xop_class, name);
+    if (value != NULL && value->value != GST_JPEGTRAN_XOP_AUTO) {
+      op.xop = value->value;
+      g_array_append_val (ops, op);
+      continue;
+    }
+    GST_WARNING_OBJECT (self, "ignoring unknown operation '%s'", name);
   }
-  filter->tjInstance = tjInitTransform();
-  if( filter->tjInstance == NULL) {
-    GST_ELEMENT_ERROR (filter, STREAM, WRONG_TYPE, ("cannot init transform"),
-        (NULL));
-    // TODO
+  g_strfreev (names);
+  g_type_class_unref (xop_class);
+
+  return ops;
+}
+
+static GstJpegTranXop
+gst_jpegtran_ops_xop (GArray * ops, gboolean * has_crop)
+{
+  GstJpegTranXop xop = TJXOP_NONE;
+  guint i;
+
+  *has_crop = FALSE;
+  for (i = 0; i < ops->len; i++) {
+    GstJpegTranOp *op = &g_array_index (ops, GstJpegTranOp, i);
+
+    if (op->is_crop)
+      *has_crop = TRUE;
+    else
+      xop = gst_jpegtran_compose_xop (op->xop, xop);
   }
+
+  return xop;
 }
 
+/* moves region r of a width x height image along with the pixels */
 static void
-gst_jpegtran_finalize (Gstjpegtran * filter)
+gst_jpegtran_map_region (GstJpegTranXop xop, gint * width, gint * height,
+    tjregion * r)
 {
-  tjDestroy(filter->tjHandle);
-  tjDestroy(filter->tjInstance);
+  guint f = xop_codes[xop] >> 2, n = xop_codes[xop] & 3;
+
+  if (f)
+    r->x = *width - r->x - r->w;
+  /* clockwise, (x, y) to (height - 1 - y, x) */
+  while (n--) {
+    tjregion t = *r;
+    gint tmp = *width;
+
+    r->x = *height - t.y - t.h;
+    r->y = t.x;
+    r->w = t.h;
+    r->h = t.w;
+    *width = *height;
+    *height = tmp;
+  }
 }
 
+/* Flipping or rotating a cropped image is the same as cropping the
+ * correspondingly moved region out of the flipped or rotated image, so
+ * the region is tracked in the coordinates of the whole transformed
+ * frame. Partial MCUs trimmed at the edges are not accounted for, the
+ * result is snapped and clipped to the real frame afterwards. */
 static void
-gst_jpegtran_set_property (GObject * object, guint prop_id,
+gst_jpegtran_compose_ops (GArray * ops, gint width, gint height,
+    tjtransform * xform)
+{
+  GstJpegTranXop xop = TJXOP_NONE;
+  gboolean has_crop = FALSE;
+  tjregion r = { 0, 0, width, height };
+  guint i;
+
+  for (i = 0; i < ops->len; i++) {
+    GstJpegTranOp *op = &g_array_index (ops, GstJpegTranOp, i);
+
+    if (op->is_crop) {
+      gint x = MIN (op->crop.x, r.w), y = MIN (op->crop.y, r.h);
+
+      r.x += x;
+      r.y += y;
+      r.w = op->crop.w > 0 ? MIN (op->crop.w, r.w - x) : r.w - x;
+      r.h = op->crop.h > 0 ? MIN (op->crop.h, r.h - y) : r.h - y;
+      has_crop = TRUE;
+    } else {
+      gst_jpegtran_map_region (op->xop, &width, &height, &r);
+      xop = gst_jpegtran_compose_xop (op->xop, xop);
+    }
+  }
+
+  xform->op = xop;
+  if (has_crop) {
+    xform->r = r;
+    xform->options |= TJXOPT_CROP;
+  }
+}
+
+/* GstJpegTranPad, request src pads with their own transform */
+
+static gboolean
+gst_jpegtran_pad_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+  if (gst_jpegtran_handle_crop_event (G_OBJECT (pad), event)) {
+    gst_event_unref (event);
+    return TRUE;
+  }
+  /* the allocation is redone before the next push on this pad */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_RECONFIGURE)
+    gst_pad_mark_reconfigure (pad);
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static void
+gst_jpegtran_pad_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
 {
-  Gstjpegtran *filter = GST_JPEGTRAN (object);
+  GstJpegTranPad *pad = GST_JPEGTRAN_PAD (object);
 
+  GST_OBJECT_LOCK (pad);
   switch (prop_id) {
-    case PROP_XOP:
-      filter->xop = g_value_get_enum(value);
+    case PROP_PAD_XOP:
+      pad->xop = g_value_get_enum (value);
+      pad->caps_changed = TRUE;
+      break;
+    case PROP_PAD_CROP_X:
+      pad->crop.x = g_value_get_int (value);
+      pad->caps_changed = TRUE;
+      break;
+    case PROP_PAD_CROP_Y:
+      pad->crop.y = g_value_get_int (value);
+      pad->caps_changed = TRUE;
+      break;
+    case PROP_PAD_CROP_WIDTH:
+      pad->crop.w = g_value_get_int (value);
+      pad->caps_changed = TRUE;
+      break;
+    case PROP_PAD_CROP_HEIGHT:
+      pad->crop.h = g_value_get_int (value);
+      pad->caps_changed = TRUE;
+      break;
+    case PROP_PAD_GRAY:
+      pad->gray = g_value_get_boolean (value);
+      pad->caps_changed = TRUE;
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
+  GST_OBJECT_UNLOCK (pad);
 }
 
 static void
-gst_jpegtran_get_property (GObject * object, guint prop_id,
+gst_jpegtran_pad_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec)
 {
-  Gstjpegtran *filter = GST_JPEGTRAN (object);
+  GstJpegTranPad *pad = GST_JPEGTRAN_PAD (object);
 
+  GST_OBJECT_LOCK (pad);
   switch (prop_id) {
-    case PROP_XOP:
-      g_value_set_enum(value, filter->xop);
+    case PROP_PAD_XOP:
+      g_value_set_enum (value, pad->xop);
+      break;
+    case PROP_PAD_CROP_X:
+      g_value_set_int (value, pad->crop.x);
+      break;
+    case PROP_PAD_CROP_Y:
+      g_value_set_int (value, pad->crop.y);
+      break;
+    case PROP_PAD_CROP_WIDTH:
+      g_value_set_int (value, pad->crop.w);
+      break;
+    case PROP_PAD_CROP_HEIGHT:
+      g_value_set_int (value, pad->crop.h);
+      break;
+    case PROP_PAD_GRAY:
+      g_value_set_boolean (value, pad->gray);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
+  GST_OBJECT_UNLOCK (pad);
 }
 
-/* GstElement vmethod implementations */
+static void
+gst_jpegtran_pad_finalize (GObject * object)
+{
+  GstJpegTranPad *pad = GST_JPEGTRAN_PAD (object);
 
-/* this function handles sink events */
-static gboolean
-gst_jpegtran_sink_event (GstPad * pad, GstObject * parent,
-    GstEvent * event)
+  if (pad->pool) {
+    gst_buffer_pool_set_active (pad->pool, FALSE);
+    gst_object_unref (pad->pool);
+  }
+
+  G_OBJECT_CLASS (gst_jpegtran_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_jpegtran_pad_class_init (GstJpegTranPadClass * klass)
 {
-  Gstjpegtran *filter;
-  gboolean ret;
+  GObjectClass *gobject_class = (GObjectClass *) klass;
 
-  filter = GST_JPEGTRAN (parent);
+  gobject_class->set_property = gst_jpegtran_pad_set_property;
+  gobject_class->get_property = gst_jpegtran_pad_get_property;
+  gobject_class->finalize = gst_jpegtran_pad_finalize;
 
-  /*  GST_LOG_OBJECT (filter, "Received %s event: %" GST_PTR_FORMAT,
-      GST_EVENT_TYPE_NAME (event), event);*/
+  g_object_class_install_property (gobject_class, PROP_PAD_XOP,
+      g_param_spec_enum ("xop", "transform",
+          "Transform operation to perform for this pad",
+          GST_TYPE_JPEGTRAN_XOP, DEFAULT_XOP,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
 
-  switch (GST_EVENT_TYPE (event)) {
-    case GST_EVENT_CAPS:
-    {
-      GstCaps *caps;
+  g_object_class_install_property (gobject_class, PROP_PAD_CROP_X,
+      g_param_spec_int ("crop-x", "Crop x",
+          "Left edge of the crop region in the transformed image, moved "
+          "left to the nearest MCU boundary", 0, G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_CROP_Y,
+      g_param_spec_int ("crop-y", "Crop y",
+          "Top edge of the crop region in the transformed image, moved "
+          "up to the nearest MCU boundary", 0, G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_CROP_WIDTH,
+      g_param_spec_int ("crop-width", "Crop width",
+          "Width of the crop region, 0 extends it to the right edge", 0,
+          G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PAD_CROP_HEIGHT,
+      g_param_spec_int ("crop-height", "Crop height",
+          "Height of the crop region, 0 extends it to the bottom edge", 0,
+          G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
 
-      gst_event_parse_caps (event, &caps);
-      /* do something with the caps */
+  g_object_class_install_property (gobject_class, PROP_PAD_GRAY,
+      g_param_spec_boolean ("gray", "Grayscale",
+          "Drop the chroma components of this pad's output", DEFAULT_GRAY,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+}
 
-      /* and forward */
-      ret = gst_pad_event_default (pad, parent, event);
-      break;
-    }
-    default:
-      ret = gst_pad_event_default (pad, parent, event);
-      break;
-  }
-  return ret;
+static void
+gst_jpegtran_pad_init (GstJpegTranPad * pad)
+{
+  pad->xop = DEFAULT_XOP;
+  memset (&pad->crop, 0, sizeof (pad->crop));
+  pad->gray = DEFAULT_GRAY;
+  pad->caps_changed = FALSE;
+  pad->pool = NULL;
+  pad->pool_size = 0;
+  pad->pool_from_peer = FALSE;
+
+  gst_pad_set_event_function (GST_PAD (pad), gst_jpegtran_pad_event);
 }
 
-/* chain function
- * this function does the actual processing
- */
-static GstFlowReturn
-gst_jpegtran_chain (GstPad * pad, GstObject * parent, GstBuffer * inbuf)
+static void
+gst_jpegtran_pad_get_xform (GstJpegTranPad * pad, tjtransform * xform)
 {
-  GstFlowReturn ret;
-  GstBuffer *outbuf = NULL;
-  GstBuffer *trimmedbuf = NULL;
-  Gstjpegtran *self;
-  GstMapInfo in_info;
-  GstMapInfo out_info;
+  memset (xform, 0, sizeof (tjtransform));
 
-  self = GST_JPEGTRAN (parent);
+  GST_OBJECT_LOCK (pad);
+  xform->op = pad->xop;
+  xform->r = pad->crop;
+  if (pad->gray)
+    xform->options |= TJXOPT_GRAY;
+  GST_OBJECT_UNLOCK (pad);
 
-  if (!gst_buffer_map (inbuf, &in_info, GST_MAP_READ)) {
-    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("Unable to map memory"),
-        (NULL));
-    gst_buffer_unref (inbuf);
-    return GST_FLOW_ERROR;
-  }
+  xform->options |= TJXOPT_TRIM;
+  if (xform->r.x || xform->r.y || xform->r.w || xform->r.h)
+    xform->options |= TJXOPT_CROP;
+}
+
+/* the transform of the always src pad, for inbuf when given. With ops
+ * *ops gets a reference to the list to place on the frame, or NULL */
+static void
+gst_jpegtran_get_xform (Gstjpegtran * self, GstBuffer * inbuf,
+    tjtransform * xform, GArray ** ops)
+{
+  GstJpegTranXop meta_xop;
+  gboolean has_crop, has_meta;
 
-  int width = 0,height = 0, jpegSubsamp = 0, jpegColorspace;
+  memset (xform, 0, sizeof (tjtransform));
+  if (ops)
+    *ops = NULL;
+  has_meta = inbuf != NULL && gst_jpegtran_buffer_get_xop (inbuf, &meta_xop);
 
-  if (tjDecompressHeader3(self->tjHandle,
-			   in_info.data,
-			   in_info.size,
-			   &width,
-			   &height,
-			   &jpegSubsamp,
-			   &jpegColorspace)) {
-    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("cannot decompress header: %s", tjGetErrorStr2(self->tjHandle)),
-        (NULL));
-    // TODO
+  GST_OBJECT_LOCK (self);
+  xform->op = self->xop;
+  xform->r = self->crop;
+  if (has_meta) {
+    xform->op = meta_xop;
+  } else if (self->ops->len > 0) {
+    /* the crop region is placed once the frame size is known */
+    xform->op = gst_jpegtran_ops_xop (self->ops, &has_crop);
+    memset (&xform->r, 0, sizeof (xform->r));
+    if (has_crop)
+      xform->options |= TJXOPT_CROP;
+    if (ops)
+      *ops = g_array_ref (self->ops);
   }
+  if (self->gray)
+    xform->options |= TJXOPT_GRAY;
+  if (self->progressive)
+    xform->options |= TJXOPT_PROGRESSIVE;
+  if (self->copy_markers != GST_JPEGTRAN_COPY_MARKERS_ALL)
+    xform->options |= TJXOPT_COPYNONE;
+#ifdef TJXOPT_OPTIMIZE
+  if (self->optimize)
+    xform->options |= TJXOPT_OPTIMIZE;
+#endif
+  GST_OBJECT_UNLOCK (self);
 
-  GST_LOG_OBJECT (pad,
-		  "width %d, height %d, subsamp %d, size %d",
-		  width,height,jpegSubsamp,
-		  tjBufSize(width,
-			    height,
-			    jpegSubsamp)
+  xform->options |= TJXOPT_TRIM;
+  if (xform->r.x || xform->r.y || xform->r.w || xform->r.h)
+    xform->options |= TJXOPT_CROP;
+}
 
-		  );
+/* output buffers of request pads come from the pool downstream offers
+ * for their caps, or else from a plain pool of their own. Either is
+ * replaced by a larger plain pool when frames outgrow it, after a
+ * downstream pool the caps are pushed again to ask for that size */
+static GstBuffer *
+gst_jpegtran_pad_alloc (GstJpegTranPad * pad, gsize size)
+{
+  GstBufferPool *pool, *old = NULL;
+  GstBuffer *buf = NULL;
 
-  tjtransform xform;
-  memset(&xform, 0, sizeof(tjtransform));
-  xform.op = self->xop;
-  xform.options |= TJXOPT_TRIM;
-  int flags = TJFLAG_NOREALLOC;
-  outbuf = gst_buffer_new ();
-  GstMemory *mem;
-  mem = gst_allocator_alloc (NULL,
-			     tjBufSize(width,
-				       height,
-				       jpegSubsamp),
-			     NULL);
-  gst_buffer_append_memory (outbuf, mem);
+  GST_OBJECT_LOCK (pad);
+  if (pad->pool == NULL || pad->pool_size < size) {
+    GstStructure *config;
 
-  if (!gst_buffer_map (outbuf, &out_info, GST_MAP_WRITE)) {
-    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("Unable to map memory"),
-        (NULL));
-    gst_buffer_unref (outbuf);
-    // TODO
-    return GST_FLOW_ERROR;
+    old = pad->pool;
+    if (pad->pool_from_peer)
+      pad->caps_changed = TRUE;
+    pad->pool_from_peer = FALSE;
+    pad->pool_size = size + size / 8;
+    pad->pool = gst_buffer_pool_new ();
+    config = gst_buffer_pool_get_config (pad->pool);
+    gst_buffer_pool_config_set_params (config, NULL, pad->pool_size, 0, 0);
+    gst_buffer_pool_set_config (pad->pool, config);
+    gst_buffer_pool_set_active (pad->pool, TRUE);
   }
+  pool = gst_object_ref (pad->pool);
+  GST_OBJECT_UNLOCK (pad);
 
-  unsigned char *dstBufs[] = { out_info.data };
-  unsigned long dstSizes[] = { out_info.size };
+  if (old) {
+    gst_buffer_pool_set_active (old, FALSE);
+    gst_object_unref (old);
+  }
 
-  if(tjTransform(self->tjInstance,
-		 in_info.data,
-		 in_info.size,
-		 1,
-		 dstBufs,
-		 dstSizes,
-		 &xform, flags) < 0) {
-    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("tjTransform failed"),
-		       (NULL));
-    // TODO error
+  if (gst_buffer_pool_acquire_buffer (pool, &buf, NULL) != GST_FLOW_OK)
+    buf = NULL;
+  gst_object_unref (pool);
+
+  return buf;
+}
+
+/* asks downstream of pad for a pool for caps, called when they are
+ * pushed and after a RECONFIGURE */
+static void
+gst_jpegtran_pad_query_allocation (GstJpegTranPad * pad, GstCaps * caps)
+{
+  GstQuery *query;
+  GstBufferPool *pool = NULL, *old;
+  guint size = 0, min = 0, max = 0;
+
+  query = gst_query_new_allocation (caps, TRUE);
+  if (gst_pad_peer_query (GST_PAD (pad), query)
+      && gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+  gst_query_unref (query);
+
+  GST_OBJECT_LOCK (pad);
+  size = MAX (size, pad->pool_size);
+  /* the pool in use, configured already */
+  if (pool != NULL && pool == pad->pool) {
+    GST_OBJECT_UNLOCK (pad);
+    gst_object_unref (pool);
+    return;
   }
+  GST_OBJECT_UNLOCK (pad);
 
-  GST_LOG_OBJECT (pad,
-		  "in %d dstSizes[0] %d delta %d",
-		  in_info.size,
-		  dstSizes[0],
-		  dstSizes[0]-in_info.size
-		  );
+  /* without a frame seen yet the size is not known */
+  if (pool != NULL && size > 0) {
+    GstStructure *config = gst_buffer_pool_get_config (pool);
 
-  gst_buffer_unmap (inbuf, &in_info);
-  gst_buffer_unmap (outbuf, &out_info);
+    gst_buffer_pool_config_set_params (config, caps, size, min, max);
+    if (!gst_buffer_pool_set_config (pool, config)
+        || !gst_buffer_pool_set_active (pool, TRUE)) {
+      GST_DEBUG_OBJECT (pad, "cannot use the downstream pool");
+      gst_clear_object (&pool);
+    }
+  } else {
+    gst_clear_object (&pool);
+  }
+  /* keep a plain pool when downstream offers none, but not one it gave
+   * before */
+  if (pool == NULL) {
+    GST_OBJECT_LOCK (pad);
+    if (pad->pool_from_peer) {
+      old = pad->pool;
+      pad->pool = NULL;
+      pad->pool_from_peer = FALSE;
+    } else {
+      old = NULL;
+    }
+    GST_OBJECT_UNLOCK (pad);
+    if (old) {
+      gst_buffer_pool_set_active (old, FALSE);
+      gst_object_unref (old);
+    }
+    return;
+  }
 
-  trimmedbuf = gst_buffer_copy_region(outbuf,
-				      GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META | GST_BUFFER_COPY_MEMORY,
-				      0,
-				      dstSizes[0]
-				      );
+  GST_DEBUG_OBJECT (pad, "using downstream pool %" GST_PTR_FORMAT
+      " of %u byte buffers", pool, size);
 
-  ret = gst_pad_push (self->srcpad, trimmedbuf);
-  gst_buffer_unref (inbuf);
-  gst_buffer_unref (outbuf);
+  GST_OBJECT_LOCK (pad);
+  old = pad->pool;
+  pad->pool = pool;
+  pad->pool_size = size;
+  pad->pool_from_peer = TRUE;
+  GST_OBJECT_UNLOCK (pad);
 
-  return ret;
+  if (old) {
+    gst_buffer_pool_set_active (old, FALSE);
+    gst_object_unref (old);
+  }
 }
 
+static void gst_jpegtran_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_jpegtran_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+
+static gboolean gst_jpegtran_start (GstBaseTransform * trans);
+static gboolean gst_jpegtran_stop (GstBaseTransform * trans);
+static GstCaps *gst_jpegtran_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter);
+static gboolean gst_jpegtran_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static gboolean gst_jpegtran_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, gsize size,
+    GstCaps * othercaps, gsize * othersize);
+static gboolean gst_jpegtran_decide_allocation (GstBaseTransform * trans,
+    GstQuery * query);
+static GstFlowReturn gst_jpegtran_prepare_output_buffer (GstBaseTransform *
+    trans, GstBuffer * inbuf, GstBuffer ** outbuf);
+static GstFlowReturn gst_jpegtran_transform (GstBaseTransform * trans,
+    GstBuffer * inbuf, GstBuffer * outbuf);
+static gboolean gst_jpegtran_src_event (GstBaseTransform * trans,
+    GstEvent * event);
+static gboolean gst_jpegtran_sink_event (GstBaseTransform * trans,
+    GstEvent * event);
+static GstFlowReturn gst_jpegtran_submit_input_buffer (GstBaseTransform *
+    trans, gboolean is_discont, GstBuffer * input);
+static GstFlowReturn gst_jpegtran_generate_output (GstBaseTransform * trans,
+    GstBuffer ** outbuf);
+static gboolean gst_jpegtran_transform_meta (GstBaseTransform * trans,
+    GstBuffer * outbuf, GstMeta * meta, GstBuffer * inbuf);
+static void gst_jpegtran_finalize (GObject * object);
+static GstPad *gst_jpegtran_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_jpegtran_release_pad (GstElement * element, GstPad * pad);
+
+static void gst_jpegtran_start_workers (Gstjpegtran * self, guint n_threads);
+static void gst_jpegtran_stop_workers (Gstjpegtran * self);
+static GstFlowReturn gst_jpegtran_drain (Gstjpegtran * self, gboolean push);
+static void gst_jpegtran_reset_framing (Gstjpegtran * self);
+static GstFlowReturn gst_jpegtran_chain_list (GstPad * pad,
+    GstObject * parent, GstBufferList * list);
+static gboolean gst_jpegtran_src_activate_mode (GstPad * pad,
+    GstObject * parent, GstPadMode mode, gboolean active);
+static void gst_jpegtran_ring_free (Gstjpegtran * self);
+
+/* GObject vmethod implementations */
+
+/* initialize the jpegtran's class */
+static void
+gst_jpegtran_class_init (GstjpegtranClass * klass)
+{
+  GObjectClass *gobject_class;
+  GstElementClass *gstelement_class;
+  GstBaseTransformClass *trans_class;
+  static const gchar *meta_tags[] = { NULL };
+
+  gobject_class = (GObjectClass *) klass;
+  gstelement_class = (GstElementClass *) klass;
+  trans_class = (GstBaseTransformClass *) klass;
+
+  gobject_class->set_property = gst_jpegtran_set_property;
+  gobject_class->get_property = gst_jpegtran_get_property;
+  gobject_class->finalize = gst_jpegtran_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_XOP,
+      g_param_spec_enum ("xop", "transform",
+          "Transform opertation to perform", GST_TYPE_JPEGTRAN_XOP,
+          DEFAULT_XOP, G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CROP_X,
+      g_param_spec_int ("crop-x", "Crop x",
+          "Left edge of the crop region in the transformed image, moved "
+          "left to the nearest MCU boundary", 0, G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CROP_Y,
+      g_param_spec_int ("crop-y", "Crop y",
+          "Top edge of the crop region in the transformed image, moved "
+          "up to the nearest MCU boundary", 0, G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CROP_WIDTH,
+      g_param_spec_int ("crop-width", "Crop width",
+          "Width of the crop region, 0 extends it to the right edge", 0,
+          G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CROP_HEIGHT,
+      g_param_spec_int ("crop-height", "Crop height",
+          "Height of the crop region, 0 extends it to the bottom edge", 0,
+          G_MAXUINT16, 0,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_GRAY,
+      g_param_spec_boolean ("gray", "Grayscale",
+          "Drop the chroma components and output a luminance-only JPEG",
+          DEFAULT_GRAY, G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PROGRESSIVE,
+      g_param_spec_boolean ("progressive", "Progressive",
+          "Re-encode the entropy coded data as a progressive JPEG",
+          DEFAULT_PROGRESSIVE, G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_OPTIMIZE,
+      g_param_spec_boolean ("optimize", "Optimize",
+          "Re-encode with optimized Huffman tables (needs libjpeg-turbo 3.0, "
+          "progressive output is always optimized)", DEFAULT_OPTIMIZE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_COPY_MARKERS,
+      g_param_spec_enum ("copy-markers", "Copy markers",
+          "Which APPn and COM markers of the input to keep",
+          GST_TYPE_JPEGTRAN_COPY_MARKERS, DEFAULT_COPY_MARKERS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MARKER_LIST,
+      g_param_spec_string ("marker-list", "Marker list",
+          "Comma separated markers to keep with copy-markers=custom, "
+          "e.g. \"app1,app2,com\"", DEFAULT_MARKER_LIST,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_VIRTUAL_ROTATION,
+      g_param_spec_boolean ("virtual-rotation", "Virtual rotation",
+          "Compose xop with the EXIF orientation and only rewrite that, "
+          "the image data is shared with the input. Falls back to a real "
+          "transform with cropping, ops, gray, progressive, optimize or "
+          "request pads", DEFAULT_VIRTUAL_ROTATION,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_OPS,
+      g_param_spec_string ("ops", "Operations",
+          "Comma separated transforms applied in order, any of the xop "
+          "names and crop=x:y:width:height, e.g. \"rot90,hflip,crop=0:0:"
+          "640:480\". They are collapsed into a single pass and replace "
+          "xop and crop-* when set", DEFAULT_OPS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_BYTES_SAVED,
+      g_param_spec_int64 ("bytes-saved", "Bytes saved",
+          "Input minus output bytes of the frames coded with progressive "
+          "or optimize", G_MININT64, G_MAXINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_CODING_TIME,
+      g_param_spec_uint64 ("coding-time", "Coding time",
+          "Time spent transforming the frames coded with progressive or "
+          "optimize, in nanoseconds", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PREDICT_HITS,
+      g_param_spec_uint64 ("predictor-hits", "Predictor hits",
+          "Frames that fit in the predicted output buffer", 0, G_MAXUINT64,
+          0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_PREDICT_MISSES,
+      g_param_spec_uint64 ("predictor-misses", "Predictor misses",
+          "Frames that overran the predicted output buffer and had to be "
+          "reallocated", 0, G_MAXUINT64, 0,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Transformed frames, bytes in and out, transform time percentiles "
+          "and error counts since start", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint64 ("stats-interval", "Statistics interval",
+          "Post the stats as a GstJpegTranStats element message this often, "
+          "in nanoseconds. 0 disables the messages", 0, G_MAXUINT64,
+          DEFAULT_STATS_INTERVAL, G_PARAM_READWRITE |
+          GST_PARAM_MUTABLE_PLAYING | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+          "Frames transformed in parallel on the workers all jpegtran "
+          "instances share, output order is kept. 1 transforms on the "
+          "streaming thread, 0 uses as many as there are CPUs", 0, 256,
+          DEFAULT_N_THREADS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_N_STRIPE_THREADS,
+      g_param_spec_uint ("n-stripe-threads", "Number of stripe threads",
+          "Restart interval stripes of a single large frame transformed in "
+          "parallel on the stripe threads all jpegtran instances share. 1 "
+          "disables splitting, 0 uses as many as there are CPUs", 0, 256,
+          DEFAULT_N_STRIPE_THREADS,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+          G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_QUEUE_FRAMES,
+      g_param_spec_uint ("output-queue-frames", "Output queue frames",
+          "Frames waiting for a thread of their own that pushes them "
+          "downstream, so that transforming and pushing overlap. 0 with "
+          "output-queue-bytes 0 pushes from the streaming thread, 0 alone "
+          "leaves the queue bounded by output-queue-bytes. Buffer lists "
+          "are queued and pushed buffer by buffer", 0, G_MAXINT,
+          DEFAULT_OUTPUT_QUEUE_FRAMES, G_PARAM_READWRITE |
+          GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_OUTPUT_QUEUE_BYTES,
+      g_param_spec_uint64 ("output-queue-bytes", "Output queue bytes",
+          "Bytes of frames waiting to be pushed downstream by a thread of "
+          "their own, 0 for no limit in bytes. See output-queue-frames",
+          0, G_MAXUINT64, DEFAULT_OUTPUT_QUEUE_BYTES, G_PARAM_READWRITE |
+          GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_set_details_simple (gstelement_class,
+					"Losslessly transform a JPEG image into another JPEG image",
+					"Filter Image",
+					"Rearranges the compressed data (DCT coefficients) using libturbojpeg without ever fully decoding the image.",
+					"Petri Ahonen <peahonen@gmail.com>");
+
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&src_factory));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_static_pad_template_get (&sink_factory));
+  gst_element_class_add_pad_template (gstelement_class,
+      gst_pad_template_new_from_static_pad_template_with_gtype
+      (&src_request_factory, GST_TYPE_JPEGTRAN_PAD));
+
+  gstelement_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_request_new_pad);
+  gstelement_class->release_pad = GST_DEBUG_FUNCPTR (gst_jpegtran_release_pad);
+
+  trans_class->start = GST_DEBUG_FUNCPTR (gst_jpegtran_start);
+  trans_class->stop = GST_DEBUG_FUNCPTR (gst_jpegtran_stop);
+  trans_class->transform_caps =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_transform_caps);
+  trans_class->set_caps = GST_DEBUG_FUNCPTR (gst_jpegtran_set_caps);
+  trans_class->transform_size =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_transform_size);
+  trans_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_decide_allocation);
+  trans_class->prepare_output_buffer =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_prepare_output_buffer);
+  trans_class->transform = GST_DEBUG_FUNCPTR (gst_jpegtran_transform);
+  trans_class->src_event = GST_DEBUG_FUNCPTR (gst_jpegtran_src_event);
+  trans_class->sink_event = GST_DEBUG_FUNCPTR (gst_jpegtran_sink_event);
+  trans_class->submit_input_buffer =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_submit_input_buffer);
+  trans_class->generate_output =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_generate_output);
+  trans_class->transform_meta =
+      GST_DEBUG_FUNCPTR (gst_jpegtran_transform_meta);
+
+  gst_meta_register_custom (GST_JPEGTRAN_META, meta_tags, NULL, NULL, NULL);
+
+  /* xop=none hands the input buffer through untouched */
+  trans_class->passthrough_on_same_caps = FALSE;
+  trans_class->transform_ip_on_passthrough = FALSE;
+
+  GST_DEBUG_CATEGORY_INIT (gst_jpegtran_debug, "jpegtran", 0,
+			   "jpegtran");
+
+}
+
+/* statistics */
+
+static guint
+gst_jpegtran_stats_bucket (guint64 us)
+{
+  guint exp;
+
+  if (us < GST_JPEGTRAN_STATS_SUB_BUCKETS)
+    return us;
+
+  /* the top 4 bits pick the octave and the step within it */
+  exp = g_bit_storage (us) - 4;
+  return MIN ((exp + 1) * GST_JPEGTRAN_STATS_SUB_BUCKETS
+      + (us >> exp) - GST_JPEGTRAN_STATS_SUB_BUCKETS,
+      GST_JPEGTRAN_STATS_BUCKETS - 1);
+}
+
+/* upper edge of a bucket */
+static GstClockTime
+gst_jpegtran_stats_bucket_time (guint bucket)
+{
+  guint exp, step;
+
+  if (bucket < GST_JPEGTRAN_STATS_SUB_BUCKETS)
+    return (bucket + 1) * GST_USECOND;
+
+  exp = bucket / GST_JPEGTRAN_STATS_SUB_BUCKETS - 1;
+  step = bucket % GST_JPEGTRAN_STATS_SUB_BUCKETS
+      + GST_JPEGTRAN_STATS_SUB_BUCKETS;
+  return ((guint64) (step + 1) << exp) * GST_USECOND;
+}
+
+/* called with the object lock held */
+static GstClockTime
+gst_jpegtran_stats_percentile (Gstjpegtran * self, guint percent)
+{
+  guint64 count = 0, rank;
+  guint i;
+
+  if (self->stats_frames == 0)
+    return 0;
+
+  rank = (self->stats_frames * percent + 99) / 100;
+  for (i = 0; i < GST_JPEGTRAN_STATS_BUCKETS; i++) {
+    count += self->stats_hist[i];
+    if (count >= rank)
+      return MIN (gst_jpegtran_stats_bucket_time (i), self->stats_time_max);
+  }
+
+  return self->stats_time_max;
+}
+
+/* called with the object lock held */
+static void
+gst_jpegtran_reset_stats (Gstjpegtran * self)
+{
+  self->stats_frames = self->stats_errors = 0;
+  self->stats_bytes_in = self->stats_bytes_out = 0;
+  self->stats_alloc_bytes = 0;
+  self->stats_time_max = 0;
+  memset (self->stats_hist, 0, sizeof (self->stats_hist));
+  self->stats_last_post = GST_CLOCK_TIME_NONE;
+  self->qos_processed = self->qos_dropped = 0;
+}
+
+/* called with the object lock held */
+static GstStructure *
+gst_jpegtran_get_stats (Gstjpegtran * self)
+{
+  guint64 frames = self->stats_frames;
+
+  return gst_structure_new ("GstJpegTranStats",
+      "frames", G_TYPE_UINT64, frames,
+      "bytes-in", G_TYPE_UINT64, self->stats_bytes_in,
+      "bytes-out", G_TYPE_UINT64, self->stats_bytes_out,
+      "ratio", G_TYPE_DOUBLE, self->stats_bytes_in > 0 ?
+      (gdouble) self->stats_bytes_out / self->stats_bytes_in : 0.0,
+      "time-p50", G_TYPE_UINT64, gst_jpegtran_stats_percentile (self, 50),
+      "time-p99", G_TYPE_UINT64, gst_jpegtran_stats_percentile (self, 99),
+      "time-max", G_TYPE_UINT64, self->stats_time_max,
+      "alloc-size", G_TYPE_UINT64, frames > 0 ?
+      self->stats_alloc_bytes / frames : 0,
+      "pool-size", G_TYPE_UINT64, (guint64) self->pool_size,
+      "predictor-misses", G_TYPE_UINT64, self->predict_misses,
+      "dropped", G_TYPE_UINT64, self->qos_dropped,
+      "errors", G_TYPE_UINT64, self->stats_errors, NULL);
+}
+
+/* account one transformed frame and post the stats when they are due,
+ * called with the object lock held which it releases */
+static void
+gst_jpegtran_update_stats_unlock (Gstjpegtran * self, gsize in_size,
+    gsize out_size, gsize alloc_size, GstClockTime duration)
+{
+  GstStructure *s = NULL;
+  GstClockTime now;
+
+  self->stats_frames++;
+  self->stats_bytes_in += in_size;
+  self->stats_bytes_out += out_size;
+  self->stats_alloc_bytes += alloc_size;
+  self->stats_time_max = MAX (self->stats_time_max, duration);
+  self->stats_hist[gst_jpegtran_stats_bucket (duration / GST_USECOND)]++;
+
+  if (self->stats_interval > 0) {
+    now = g_get_monotonic_time () * GST_USECOND;
+    if (!GST_CLOCK_TIME_IS_VALID (self->stats_last_post))
+      self->stats_last_post = now;
+    else if (now - self->stats_last_post >= self->stats_interval) {
+      self->stats_last_post = now;
+      s = gst_jpegtran_get_stats (self);
+    }
+  }
+  GST_OBJECT_UNLOCK (self);
+
+  if (s)
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self), s));
+}
+
+/* passthrough when tjTransform() would not change anything and no
+ * request pad needs its output */
+static void
+gst_jpegtran_update_passthrough (Gstjpegtran * filter)
+{
+  gboolean passthrough, has_crop = FALSE;
+  GstJpegTranXop xop;
+
+  GST_OBJECT_LOCK (filter);
+  if (filter->ops->len > 0)
+    xop = gst_jpegtran_ops_xop (filter->ops, &has_crop);
+  else
+    xop = filter->xop;
+  passthrough = xop == TJXOP_NONE && !has_crop && filter->extra_pads == NULL
+      && filter->crop.x == 0 && filter->crop.y == 0
+      && filter->crop.w == 0 && filter->crop.h == 0 && !filter->gray
+      && !filter->progressive && !filter->optimize && !filter->per_buffer_xop
+      && filter->copy_markers == GST_JPEGTRAN_COPY_MARKERS_ALL;
+  GST_OBJECT_UNLOCK (filter);
+
+  gst_base_transform_set_passthrough (GST_BASE_TRANSFORM (filter),
+      passthrough);
+}
+
+/* initialize the new element
+ * initialize instance structure
+ */
+static void
+gst_jpegtran_init (Gstjpegtran * filter)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (filter);
+
+  filter->xop = DEFAULT_XOP;
+  filter->tag_xop = TJXOP_NONE;
+  filter->orientation_tags = NULL;
+  filter->meta_auto = FALSE;
+  filter->per_buffer_xop = FALSE;
+  memset (&filter->crop, 0, sizeof (filter->crop));
+  filter->gray = DEFAULT_GRAY;
+  filter->progressive = DEFAULT_PROGRESSIVE;
+  filter->optimize = DEFAULT_OPTIMIZE;
+  filter->virtual_rotation = DEFAULT_VIRTUAL_ROTATION;
+  filter->ops = g_array_new (FALSE, FALSE, sizeof (GstJpegTranOp));
+  filter->ops_string = NULL;
+  filter->copy_markers = DEFAULT_COPY_MARKERS;
+  filter->marker_list = NULL;
+  filter->marker_mask = 0;
+  filter->pool_size = 0;
+  filter->width = filter->height = 0;
+  filter->subsamp = TJSAMP_444;
+  filter->sof_size = 0;
+  filter->max_insize = 0;
+  filter->ratio = DEFAULT_RATIO;
+  filter->predict_hits = filter->predict_misses = 0;
+  filter->bytes_saved = 0;
+  filter->coding_time = 0;
+  filter->stats_interval = DEFAULT_STATS_INTERVAL;
+  gst_jpegtran_reset_stats (filter);
+
+  filter->earliest_time = GST_CLOCK_TIME_NONE;
+  filter->proportion = 1.0;
+  filter->qos_discont = FALSE;
+
+  filter->framing = FALSE;
+  filter->may_frame = FALSE;
+  filter->adapter = gst_adapter_new ();
+  filter->frame_duration = GST_CLOCK_TIME_NONE;
+  g_queue_init (&filter->frames);
+  gst_jpegtran_reset_framing (filter);
+
+  filter->n_threads = DEFAULT_N_THREADS;
+  filter->client = NULL;
+  filter->n_workers = 0;
+  filter->list_handle = NULL;
+
+  filter->queue_frames = DEFAULT_OUTPUT_QUEUE_FRAMES;
+  filter->queue_bytes = DEFAULT_OUTPUT_QUEUE_BYTES;
+  filter->ring = NULL;
+  filter->ring_size = 0;
+  filter->ring_mask = 0;
+  g_mutex_init (&filter->ring_lock);
+  g_cond_init (&filter->ring_cond);
+  g_queue_init (&filter->pending);
+  g_mutex_init (&filter->lock);
+  g_cond_init (&filter->cond);
+
+  filter->n_stripe_threads = DEFAULT_N_STRIPE_THREADS;
+  filter->n_stripe_workers = 0;
+
+  filter->extra_pads = NULL;
+  filter->extra_pad_count = 0;
+
+  gst_base_transform_set_qos_enabled (trans, TRUE);
+  gst_jpegtran_update_passthrough (filter);
+
+  gst_pad_set_chain_list_function (trans->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_jpegtran_chain_list));
+  /* the task of the output queue has to stop before the base class
+   * deactivates the pad */
+  filter->src_activate_mode = GST_PAD_ACTIVATEMODEFUNC (trans->srcpad);
+  gst_pad_set_activatemode_function (trans->srcpad,
+      GST_DEBUG_FUNCPTR (gst_jpegtran_src_activate_mode));
+}
+
+/* "app1, app2,COM" to a marker_mask */
+static guint32
+gst_jpegtran_parse_marker_list (Gstjpegtran * self, const gchar * list)
+{
+  gchar **names;
+  guint32 mask = 0;
+  guint i;
+
+  if (list == NULL)
+    return 0;
+
+  names = g_strsplit (list, ",", -1);
+  for (i = 0; names[i] != NULL; i++) {
+    gchar *name = g_strstrip (names[i]);
+    gchar *end;
+    guint64 n;
+
+    if (*name == '\0')
+      continue;
+    if (g_ascii_strcasecmp (name, "com") == 0) {
+      mask |= MARKER_MASK_COM;
+      continue;
+    }
+    if (g_ascii_strncasecmp (name, "app", 3) == 0) {
+      n = g_ascii_strtoull (name + 3, &end, 10);
+      if (end != name + 3 && *end == '\0' && n <= 15) {
+        mask |= 1 << n;
+        continue;
+      }
+    }
+    GST_WARNING_OBJECT (self, "ignoring unknown marker '%s'", name);
+  }
+  g_strfreev (names);
+
+  return mask;
+}
+
+static void
+gst_jpegtran_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  Gstjpegtran *filter = GST_JPEGTRAN (object);
+
+  switch (prop_id) {
+    case PROP_XOP:
+      GST_OBJECT_LOCK (filter);
+      filter->xop = g_value_get_enum(value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_OPS:
+    {
+      GArray *ops = gst_jpegtran_parse_ops (filter,
+          g_value_get_string (value));
+
+      GST_OBJECT_LOCK (filter);
+      g_free (filter->ops_string);
+      filter->ops_string = g_value_dup_string (value);
+      g_array_unref (filter->ops);
+      filter->ops = ops;
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    }
+    case PROP_VIRTUAL_ROTATION:
+      GST_OBJECT_LOCK (filter);
+      filter->virtual_rotation = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_COPY_MARKERS:
+      GST_OBJECT_LOCK (filter);
+      filter->copy_markers = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      break;
+    case PROP_MARKER_LIST:
+    {
+      guint32 mask = gst_jpegtran_parse_marker_list (filter,
+          g_value_get_string (value));
+
+      GST_OBJECT_LOCK (filter);
+      g_free (filter->marker_list);
+      filter->marker_list = g_value_dup_string (value);
+      filter->marker_mask = mask;
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    }
+    case PROP_CROP_X:
+      GST_OBJECT_LOCK (filter);
+      filter->crop.x = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_CROP_Y:
+      GST_OBJECT_LOCK (filter);
+      filter->crop.y = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_CROP_WIDTH:
+      GST_OBJECT_LOCK (filter);
+      filter->crop.w = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_CROP_HEIGHT:
+      GST_OBJECT_LOCK (filter);
+      filter->crop.h = g_value_get_int (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_GRAY:
+      GST_OBJECT_LOCK (filter);
+      filter->gray = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_PROGRESSIVE:
+      GST_OBJECT_LOCK (filter);
+      filter->progressive = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (filter);
+      gst_jpegtran_update_passthrough (filter);
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_OPTIMIZE:
+      GST_OBJECT_LOCK (filter);
+      filter->optimize = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (filter);
+#ifndef TJXOPT_OPTIMIZE
+      if (g_value_get_boolean (value))
+        GST_WARNING_OBJECT (filter, "libturbojpeg cannot optimize Huffman "
+            "tables of baseline output, set progressive instead");
+#endif
+      gst_jpegtran_update_passthrough (filter);
+      /* decides between virtual rotation and a real one */
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (filter));
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (filter);
+      filter->stats_interval = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (filter);
+      filter->n_threads = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_N_STRIPE_THREADS:
+      GST_OBJECT_LOCK (filter);
+      filter->n_stripe_threads = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_OUTPUT_QUEUE_FRAMES:
+      GST_OBJECT_LOCK (filter);
+      filter->queue_frames = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_OUTPUT_QUEUE_BYTES:
+      GST_OBJECT_LOCK (filter);
+      filter->queue_bytes = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_jpegtran_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  Gstjpegtran *filter = GST_JPEGTRAN (object);
+
+  switch (prop_id) {
+    case PROP_XOP:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_enum(value, filter->xop);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_CROP_X:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_int (value, filter->crop.x);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_CROP_Y:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_int (value, filter->crop.y);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_CROP_WIDTH:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_int (value, filter->crop.w);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_CROP_HEIGHT:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_int (value, filter->crop.h);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_GRAY:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_boolean (value, filter->gray);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_PROGRESSIVE:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_boolean (value, filter->progressive);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_OPTIMIZE:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_boolean (value, filter->optimize);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_OPS:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_string (value, filter->ops_string);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_VIRTUAL_ROTATION:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_boolean (value, filter->virtual_rotation);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_COPY_MARKERS:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_enum (value, filter->copy_markers);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_MARKER_LIST:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_string (value, filter->marker_list);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_BYTES_SAVED:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_int64 (value, filter->bytes_saved);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_CODING_TIME:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint64 (value, filter->coding_time);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_PREDICT_HITS:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint64 (value, filter->predict_hits);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_PREDICT_MISSES:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint64 (value, filter->predict_misses);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_STATS:
+      GST_OBJECT_LOCK (filter);
+      g_value_take_boxed (value, gst_jpegtran_get_stats (filter));
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint64 (value, filter->stats_interval);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint (value, filter->n_threads);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_N_STRIPE_THREADS:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint (value, filter->n_stripe_threads);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_OUTPUT_QUEUE_FRAMES:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint (value, filter->queue_frames);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    case PROP_OUTPUT_QUEUE_BYTES:
+      GST_OBJECT_LOCK (filter);
+      g_value_set_uint64 (value, filter->queue_bytes);
+      GST_OBJECT_UNLOCK (filter);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_jpegtran_finalize (GObject * object)
+{
+  Gstjpegtran *filter = GST_JPEGTRAN (object);
+
+  gst_jpegtran_reset_framing (filter);
+  g_object_unref (filter->adapter);
+  if (filter->orientation_tags)
+    gst_tag_list_unref (filter->orientation_tags);
+  g_mutex_clear (&filter->ring_lock);
+  g_cond_clear (&filter->ring_cond);
+  g_mutex_clear (&filter->lock);
+  g_cond_clear (&filter->cond);
+  g_list_free_full (filter->extra_pads, gst_object_unref);
+  g_free (filter->marker_list);
+  g_array_unref (filter->ops);
+  g_free (filter->ops_string);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* GstElement vmethod implementations */
+
+static gboolean
+gst_jpegtran_copy_sticky_event (GstPad * pad, GstEvent ** event,
+    gpointer user_data)
+{
+  GstPad *srcpad = GST_PAD (user_data);
+
+  gst_pad_store_sticky_event (srcpad, *event);
+
+  return TRUE;
+}
+
+static GstPad *
+gst_jpegtran_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (element);
+  GstPad *pad;
+  gchar *pad_name;
+
+  GST_OBJECT_LOCK (self);
+  if (name)
+    pad_name = g_strdup (name);
+  else
+    pad_name = g_strdup_printf ("src_%u", self->extra_pad_count);
+  self->extra_pad_count++;
+  GST_OBJECT_UNLOCK (self);
+
+  pad = g_object_new (GST_TYPE_JPEGTRAN_PAD, "name", pad_name,
+      "direction", GST_PAD_SRC, "template", templ, NULL);
+  g_free (pad_name);
+
+  if (!gst_element_add_pad (element, pad)) {
+    gst_object_unref (pad);
+    return NULL;
+  }
+
+  /* pick up the stream in progress */
+  gst_pad_sticky_events_foreach (GST_BASE_TRANSFORM_SINK_PAD (self),
+      gst_jpegtran_copy_sticky_event, pad);
+  /* the caps just copied are those of the input */
+  GST_JPEGTRAN_PAD (pad)->caps_changed = TRUE;
+
+  GST_OBJECT_LOCK (self);
+  self->extra_pads = g_list_append (self->extra_pads, gst_object_ref (pad));
+  GST_OBJECT_UNLOCK (self);
+
+  gst_child_proxy_child_added (GST_CHILD_PROXY (self), G_OBJECT (pad),
+      GST_OBJECT_NAME (pad));
+  gst_jpegtran_update_passthrough (self);
+  /* virtual rotation is off with request pads */
+  gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (self));
+
+  return pad;
+}
+
+static void
+gst_jpegtran_release_pad (GstElement * element, GstPad * pad)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (element);
+  GList *link;
+
+  GST_OBJECT_LOCK (self);
+  link = g_list_find (self->extra_pads, pad);
+  if (link == NULL) {
+    GST_OBJECT_UNLOCK (self);
+    return;
+  }
+  self->extra_pads = g_list_delete_link (self->extra_pads, link);
+  GST_OBJECT_UNLOCK (self);
+
+  gst_child_proxy_child_removed (GST_CHILD_PROXY (self), G_OBJECT (pad),
+      GST_OBJECT_NAME (pad));
+
+  gst_pad_set_active (pad, FALSE);
+  gst_element_remove_pad (element, pad);
+  gst_object_unref (pad);
+
+  gst_jpegtran_update_passthrough (self);
+  gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (self));
+}
+
+/* GstChildProxy implementation, exposes the request pads so that their
+ * properties can be set as src_0::xop=rot90 */
+
+static GObject *
+gst_jpegtran_child_proxy_get_child_by_index (GstChildProxy * child_proxy,
+    guint index)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (child_proxy);
+  GObject *obj;
+
+  GST_OBJECT_LOCK (self);
+  obj = g_list_nth_data (self->extra_pads, index);
+  if (obj)
+    gst_object_ref (obj);
+  GST_OBJECT_UNLOCK (self);
+
+  return obj;
+}
+
+static guint
+gst_jpegtran_child_proxy_get_children_count (GstChildProxy * child_proxy)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (child_proxy);
+  guint count;
+
+  GST_OBJECT_LOCK (self);
+  count = g_list_length (self->extra_pads);
+  GST_OBJECT_UNLOCK (self);
+
+  return count;
+}
+
+static void
+gst_jpegtran_child_proxy_init (gpointer g_iface, gpointer iface_data)
+{
+  GstChildProxyInterface *iface = g_iface;
+
+  iface->get_child_by_index = gst_jpegtran_child_proxy_get_child_by_index;
+  iface->get_children_count = gst_jpegtran_child_proxy_get_children_count;
+}
+
+/* GstBaseTransform vmethod implementations */
+
+/* worst case tjTransform() output for the given geometry, rot90 and
+ * transpose swap the axes and with them the MCU padding */
+static gsize
+gst_jpegtran_max_output_size (gint width, gint height, gint subsamp)
+{
+  unsigned long size, rotated;
+
+  if (width <= 0 || height <= 0)
+    return 0;
+
+  size = tjBufSize (width, height, subsamp);
+  rotated = tjBufSize (height, width, subsamp);
+  if (size == (unsigned long) -1 || rotated == (unsigned long) -1)
+    return 0;
+
+  return MAX (size, rotated);
+}
+
+/* expected tjTransform() output for insize bytes of input, from the
+ * recent peak output/input ratio. Never more than the worst case for the
+ * stream geometry, so a buffer of that size cannot be overrun */
+static gsize
+gst_jpegtran_predict_size (Gstjpegtran * self, gsize insize)
+{
+  gsize size, worst;
+  gdouble ratio;
+
+  GST_OBJECT_LOCK (self);
+  ratio = self->ratio;
+  GST_OBJECT_UNLOCK (self);
+
+  size = (gsize) (insize * ratio * (1.0 + PREDICT_MARGIN)) + PREDICT_SLACK;
+  worst = gst_jpegtran_max_output_size (self->width, self->height,
+      self->subsamp);
+  if (worst > 0 && size > worst)
+    size = worst;
+
+  return size;
+}
+
+/* jump up to larger ratios at once, decay slowly towards smaller ones,
+ * called with the object lock held */
+static void
+gst_jpegtran_update_ratio (Gstjpegtran * self, gsize insize, gsize outsize)
+{
+  gdouble ratio;
+
+  if (insize == 0)
+    return;
+
+  ratio = (gdouble) outsize / insize;
+  if (ratio > self->ratio)
+    self->ratio = ratio;
+  else
+    self->ratio += (ratio - self->ratio) * PREDICT_DECAY;
+}
+
+static gint
+gst_jpegtran_subsamp_from_caps (const GstStructure * s)
+{
+  const gchar *sampling = gst_structure_get_string (s, "sampling");
+
+  if (sampling == NULL)
+    return TJSAMP_444;
+  if (g_str_equal (sampling, "YCbCr-4:2:0"))
+    return TJSAMP_420;
+  if (g_str_equal (sampling, "YCbCr-4:2:2"))
+    return TJSAMP_422;
+  if (g_str_equal (sampling, "GRAYSCALE"))
+    return TJSAMP_GRAY;
+  if (g_str_equal (sampling, "YCbCr-4:4:0"))
+    return TJSAMP_440;
+  if (g_str_equal (sampling, "YCbCr-4:1:1"))
+    return TJSAMP_411;
+
+  /* largest tjBufSize() of the lot */
+  return TJSAMP_444;
+}
+
+/* the TJSAMP_* tjDecompressHeader3() reports for the sampling factors
+ * of info, -1 for those turbojpeg has none for */
+static gint
+gst_jpegtran_subsamp_from_info (const GstJpegFrameInfo * info)
+{
+  guint h, v;
+
+  if (info->n_components == 1)
+    return TJSAMP_GRAY;
+  if (info->n_components != 3 && info->n_components != 4)
+    return -1;
+
+  /* both chroma components alike, Y and K at full resolution */
+  if (info->h_samp[0] != info->max_h_samp
+      || info->v_samp[0] != info->max_v_samp)
+    return -1;
+  if (info->h_samp[2] != info->h_samp[1]
+      || info->v_samp[2] != info->v_samp[1])
+    return -1;
+  if (info->n_components == 4 && (info->h_samp[3] != info->h_samp[0]
+          || info->v_samp[3] != info->v_samp[0]))
+    return -1;
+  if (info->max_h_samp % info->h_samp[1] != 0
+      || info->max_v_samp % info->v_samp[1] != 0)
+    return -1;
+
+  h = info->max_h_samp / info->h_samp[1];
+  v = info->max_v_samp / info->v_samp[1];
+  if (h == 1 && v == 1)
+    return TJSAMP_444;
+  if (h == 2 && v == 1)
+    return TJSAMP_422;
+  if (h == 2 && v == 2)
+    return TJSAMP_420;
+  if (h == 1 && v == 2)
+    return TJSAMP_440;
+  if (h == 4 && v == 1)
+    return TJSAMP_411;
+
+  return -1;
+}
+
+/* Width, height and TJSAMP_* of a frame without a decompressor. A
+ * stream keeps its header layout from frame to frame, so when the SOF
+ * segment of the last frame is found unchanged at the same offset its
+ * geometry is reused without walking the header. */
+static gboolean
+gst_jpegtran_frame_geometry (Gstjpegtran * self, const guint8 * data,
+    gsize size, gint * width, gint * height, gint * subsamp)
+{
+  GstJpegFrameInfo info;
+  gsize sof_size;
+
+  if (self->sof_size > 0 && self->sof_offset + self->sof_size <= size
+      && memcmp (data + self->sof_offset, self->sof, self->sof_size) == 0) {
+    *width = self->sof_width;
+    *height = self->sof_height;
+    *subsamp = self->sof_subsamp;
+    return TRUE;
+  }
+
+  self->sof_size = 0;
+  if (!gst_jpeg_parse_frame_info (data, size, &info))
+    return FALSE;
+  *subsamp = gst_jpegtran_subsamp_from_info (&info);
+  if (*subsamp < 0)
+    return FALSE;
+  *width = info.width;
+  *height = info.height;
+
+  sof_size = 2 + GST_READ_UINT16_BE (data + info.sof_offset + 2);
+  if (sof_size <= sizeof (self->sof)) {
+    GST_DEBUG_OBJECT (self, "new SOF at %" G_GSIZE_FORMAT ", %dx%d "
+        "subsamp %d", info.sof_offset, *width, *height, *subsamp);
+    memcpy (self->sof, data + info.sof_offset, sof_size);
+    self->sof_offset = info.sof_offset;
+    self->sof_size = sof_size;
+    self->sof_width = *width;
+    self->sof_height = *height;
+    self->sof_subsamp = *subsamp;
+  }
+
+  return TRUE;
+}
+
+/* Maps enough of buf to read the header up to and including SOS. That
+ * is the first memory when it holds all of it, which spares merging
+ * buffers that come in pieces when only the header is looked at. */
+static gboolean
+gst_jpegtran_map_header (GstBuffer * buf, GstMapInfo * info)
+{
+  GstJpegFrameInfo frame;
+
+  if (gst_buffer_n_memory (buf) > 1
+      && gst_buffer_map_range (buf, 0, 1, info, GST_MAP_READ)) {
+    if (gst_jpeg_parse_frame_info (info->data, info->size, &frame))
+      return TRUE;
+    gst_buffer_unmap (buf, info);
+  }
+
+  return gst_buffer_map (buf, info, GST_MAP_READ);
+}
+
+static gboolean
+gst_jpegtran_start (GstBaseTransform * trans)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  guint n_threads, n_stripe_threads, queue_frames, slots;
+  guint64 queue_bytes;
+
+  GST_OBJECT_LOCK (self);
+  self->predict_hits = self->predict_misses = 0;
+  self->bytes_saved = 0;
+  self->tag_xop = TJXOP_NONE;
+  gst_clear_tag_list (&self->orientation_tags);
+  self->meta_auto = FALSE;
+  self->coding_time = 0;
+  gst_jpegtran_reset_stats (self);
+  self->earliest_time = GST_CLOCK_TIME_NONE;
+  self->proportion = 1.0;
+  self->qos_discont = FALSE;
+  n_threads = self->n_threads;
+  n_stripe_threads = self->n_stripe_threads;
+  queue_frames = self->queue_frames;
+  queue_bytes = self->queue_bytes;
+  GST_OBJECT_UNLOCK (self);
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  if (n_threads > 1)
+    gst_jpegtran_start_workers (self, n_threads);
+
+  if (n_stripe_threads == 0)
+    n_stripe_threads = g_get_num_processors ();
+  if (n_stripe_threads > 1)
+    self->n_stripe_workers = n_stripe_threads;
+
+  /* the task starts with the src pad */
+  if (queue_frames > 0 || queue_bytes > 0) {
+    self->ring_size = queue_frames > 0 ? queue_frames : OUTPUT_QUEUE_SLOTS;
+    /* a power of two of slots, so that masking the counters stays in
+     * order when they wrap */
+    slots = 1;
+    while (slots < self->ring_size)
+      slots <<= 1;
+    self->ring = g_new0 (GstBuffer *, slots);
+    self->ring_mask = slots - 1;
+    self->ring_head = self->ring_tail = 0;
+    self->ring_bytes = 0;
+    self->ring_waiting = 0;
+    self->ring_flushing = FALSE;
+    self->ring_flow = GST_FLOW_OK;
+    GST_DEBUG_OBJECT (self, "output queue of %u frames, %" G_GUINT64_FORMAT
+        " bytes", queue_frames, queue_bytes);
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_jpegtran_stop (GstBaseTransform * trans)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+
+  gst_jpegtran_drain (self, FALSE);
+  gst_jpegtran_stop_workers (self);
+  gst_jpegtran_ring_free (self);
+
+  self->n_stripe_workers = 0;
+
+  self->pool_size = 0;
+  self->width = self->height = 0;
+  self->subsamp = TJSAMP_444;
+  self->sof_size = 0;
+  self->max_insize = 0;
+  self->ratio = DEFAULT_RATIO;
+
+  gst_jpegtran_reset_framing (self);
+  self->framing = FALSE;
+  self->may_frame = FALSE;
+  self->frame_duration = GST_CLOCK_TIME_NONE;
+
+  GST_OBJECT_LOCK (self);
+  self->per_buffer_xop = FALSE;
+  GST_OBJECT_UNLOCK (self);
+  gst_jpegtran_update_passthrough (self);
+
+  return TRUE;
+}
+
+/* size of the image after xop, TJXOPT_TRIM drops the partial iMCUs on
+ * the edges that a transform would otherwise move inwards */
+static void
+gst_jpegtran_transformed_size (GstJpegTranXop xop, gint subsamp,
+    gint * width, gint * height)
+{
+  gint w = *width, h = *height;
+
+  if (subsamp >= 0 && subsamp < TJ_NUMSAMP) {
+    if (xop == TJXOP_HFLIP || xop == TJXOP_TRANSVERSE ||
+        xop == TJXOP_ROT180 || xop == TJXOP_ROT270)
+      w = w / tjMCUWidth[subsamp] * tjMCUWidth[subsamp];
+    if (xop == TJXOP_VFLIP || xop == TJXOP_TRANSVERSE ||
+        xop == TJXOP_ROT90 || xop == TJXOP_ROT180)
+      h = h / tjMCUHeight[subsamp] * tjMCUHeight[subsamp];
+  }
+
+  if (gst_jpegtran_xop_is_transposing (xop)) {
+    *width = h;
+    *height = w;
+  } else {
+    *width = w;
+    *height = h;
+  }
+}
+
+/* move the crop region of xform onto the iMCU grid of the transformed
+ * image and clip it to the image, as TJXOPT_CROP requires */
+static void
+gst_jpegtran_snap_crop (tjtransform * xform, gint width, gint height,
+    gint subsamp)
+{
+  gint mcu_w = 16, mcu_h = 16;
+  gint x, y;
+
+  if (!(xform->options & TJXOPT_CROP))
+    return;
+
+  /* a single component image has 8x8 iMCUs */
+  if (xform->options & TJXOPT_GRAY)
+    subsamp = TJSAMP_GRAY;
+  if (subsamp >= 0 && subsamp < TJ_NUMSAMP) {
+    mcu_w = tjMCUWidth[subsamp];
+    mcu_h = tjMCUHeight[subsamp];
+  }
+  if (gst_jpegtran_xop_is_transposing (xform->op)) {
+    gint tmp = mcu_w;
+
+    mcu_w = mcu_h;
+    mcu_h = tmp;
+  }
+  gst_jpegtran_transformed_size (xform->op, subsamp, &width, &height);
+
+  /* keep the requested area inside the snapped region */
+  x = MIN (xform->r.x, width - 1) / mcu_w * mcu_w;
+  y = MIN (xform->r.y, height - 1) / mcu_h * mcu_h;
+  if (xform->r.w > 0)
+    xform->r.w = MIN (xform->r.w + xform->r.x - x, width - x);
+  if (xform->r.h > 0)
+    xform->r.h = MIN (xform->r.h + xform->r.y - y, height - y);
+  xform->r.x = x;
+  xform->r.y = y;
+}
+
+/* the caps of a frame after xform, TJXOPT_GRAY keeps only the
+ * luminance component and transposing swaps the chroma subsampling */
+static void
+gst_jpegtran_transform_structure (GstStructure * s,
+    const tjtransform * xform)
+{
+  const gchar *sampling = gst_structure_get_string (s, "sampling");
+  gboolean transposing = gst_jpegtran_xop_is_transposing (xform->op);
+  gint width, height, subsamp;
+
+  subsamp = sampling ? gst_jpegtran_subsamp_from_caps (s) : -1;
+  if (xform->options & TJXOPT_GRAY)
+    subsamp = TJSAMP_GRAY;
+
+  if (xform->op == GST_JPEGTRAN_XOP_AUTO) {
+    /* up to each frame */
+    gst_structure_remove_field (s, "width");
+    gst_structure_remove_field (s, "height");
+  } else if (gst_structure_get_int (s, "width", &width)
+      && gst_structure_get_int (s, "height", &height)) {
+    if (subsamp < 0 && ((xform->op != TJXOP_NONE
+                && xform->op != TJXOP_TRANSPOSE)
+            || (xform->options & TJXOPT_CROP))) {
+      /* the trimmed or snapped size depends on the MCU size */
+      gst_structure_remove_field (s, "width");
+      gst_structure_remove_field (s, "height");
+    } else if (xform->options & TJXOPT_CROP) {
+      tjtransform t = *xform;
+      gint w = width, h = height;
+
+      gst_jpegtran_snap_crop (&t, width, height, subsamp);
+      gst_jpegtran_transformed_size (t.op, subsamp, &w, &h);
+      gst_structure_set (s,
+          "width", G_TYPE_INT, t.r.w > 0 ? t.r.w : w - t.r.x,
+          "height", G_TYPE_INT, t.r.h > 0 ? t.r.h : h - t.r.y, NULL);
+    } else {
+      gst_jpegtran_transformed_size (xform->op, subsamp, &width, &height);
+      gst_structure_set (s, "width", G_TYPE_INT, width,
+          "height", G_TYPE_INT, height, NULL);
+    }
+  } else if (xform->options & TJXOPT_CROP) {
+    gst_structure_remove_field (s, "width");
+    gst_structure_remove_field (s, "height");
+  } else if (transposing && gst_structure_has_field (s, "width")
+      && gst_structure_has_field (s, "height")) {
+    GValue w = G_VALUE_INIT;
+
+    g_value_init (&w, G_VALUE_TYPE (gst_structure_get_value (s, "width")));
+    g_value_copy (gst_structure_get_value (s, "width"), &w);
+    gst_structure_set_value (s, "width",
+        gst_structure_get_value (s, "height"));
+    gst_structure_take_value (s, "height", &w);
+  }
+
+  if (xform->options & TJXOPT_GRAY) {
+    if (sampling)
+      gst_structure_set (s, "sampling", G_TYPE_STRING, "GRAYSCALE", NULL);
+    if (gst_structure_has_field (s, "colorspace"))
+      gst_structure_set (s, "colorspace", G_TYPE_STRING, "sGray", NULL);
+  } else if (sampling && (transposing || xform->op == GST_JPEGTRAN_XOP_AUTO)) {
+    if (transposing && g_str_equal (sampling, "YCbCr-4:2:2"))
+      gst_structure_set (s, "sampling", G_TYPE_STRING, "YCbCr-4:4:0", NULL);
+    else if (transposing && g_str_equal (sampling, "YCbCr-4:4:0"))
+      gst_structure_set (s, "sampling", G_TYPE_STRING, "YCbCr-4:2:2", NULL);
+    else if (!g_str_equal (sampling, "YCbCr-4:4:4")
+        && !g_str_equal (sampling, "YCbCr-4:2:0")
+        && !g_str_equal (sampling, "GRAYSCALE")
+        && !g_str_equal (sampling, "RGB") && !g_str_equal (sampling, "BGR"))
+      gst_structure_remove_field (s, "sampling");
+  }
+
+  /* everything else keeps the SOF type of the input */
+  if (xform->options & TJXOPT_PROGRESSIVE)
+    gst_structure_set (s, "sof-marker", G_TYPE_INT, 2, NULL);
+
+  /* byte streams come out one image per buffer */
+  if (gst_structure_has_field (s, "parsed"))
+    gst_structure_set (s, "parsed", G_TYPE_BOOLEAN, TRUE, NULL);
+}
+
+/* anything upstream that xform can turn into s */
+static void
+gst_jpegtran_untransform_structure (GstStructure * s,
+    const tjtransform * xform)
+{
+  if (xform->op != TJXOP_NONE || (xform->options & TJXOPT_CROP)) {
+    gst_structure_remove_field (s, "width");
+    gst_structure_remove_field (s, "height");
+  }
+  if ((xform->options & TJXOPT_GRAY) || xform->op == GST_JPEGTRAN_XOP_AUTO
+      || gst_jpegtran_xop_is_transposing (xform->op)) {
+    gst_structure_remove_field (s, "sampling");
+    gst_structure_remove_field (s, "colorspace");
+  }
+  if (xform->options & TJXOPT_PROGRESSIVE)
+    gst_structure_remove_field (s, "sof-marker");
+  gst_structure_remove_field (s, "parsed");
+}
+
+static GstCaps *
+gst_jpegtran_caps_for_xform (GstCaps * caps, const tjtransform * xform)
+{
+  guint i;
+
+  caps = gst_caps_make_writable (caps);
+  for (i = 0; i < gst_caps_get_size (caps); i++)
+    gst_jpegtran_transform_structure (gst_caps_get_structure (caps, i),
+        xform);
+
+  return caps;
+}
+
+/* the caps of the sink pad as the transform of a request pad leaves
+ * them, and a pool for them */
+static void
+gst_jpegtran_pad_push_caps (GstJpegTranPad * pad, GstCaps * sinkcaps)
+{
+  tjtransform xform;
+  GstCaps *caps;
+
+  GST_OBJECT_LOCK (pad);
+  pad->caps_changed = FALSE;
+  GST_OBJECT_UNLOCK (pad);
+
+  gst_jpegtran_pad_get_xform (pad, &xform);
+  caps = gst_jpegtran_caps_for_xform (gst_caps_copy (sinkcaps), &xform);
+  if (gst_pad_push_event (GST_PAD (pad), gst_event_new_caps (caps)))
+    gst_jpegtran_pad_query_allocation (pad, caps);
+  gst_caps_unref (caps);
+}
+
+/* whether a frame with xop can be passed on without tjTransform(), the
+ * object lock is held */
+static gboolean
+gst_jpegtran_can_splice_unlocked (Gstjpegtran * self, GstJpegTranXop xop,
+    gboolean has_meta, gboolean is_virtual)
+{
+  return self->extra_pads == NULL && (has_meta || self->ops->len == 0)
+      && self->crop.x == 0 && self->crop.y == 0
+      && self->crop.w == 0 && self->crop.h == 0 && !self->gray
+      && !self->progressive && !self->optimize
+      && (is_virtual || xop == TJXOP_NONE || xop == GST_JPEGTRAN_XOP_AUTO);
+}
+
+static GstCaps *
+gst_jpegtran_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  tjtransform xform;
+  gboolean is_virtual, per_buffer;
+  GstCaps *ret;
+  guint i;
+
+  gst_jpegtran_get_xform (self, NULL, &xform, NULL);
+  GST_OBJECT_LOCK (self);
+  per_buffer = self->per_buffer_xop;
+  /* like auto, the geometry can change with every frame */
+  if (per_buffer)
+    xform.op = GST_JPEGTRAN_XOP_AUTO;
+  is_virtual = self->virtual_rotation && xform.op != GST_JPEGTRAN_XOP_AUTO
+      && gst_jpegtran_can_splice_unlocked (self, xform.op, FALSE, TRUE);
+  GST_OBJECT_UNLOCK (self);
+  /* the stored image keeps its geometry when only the orientation is
+   * rewritten */
+  if (is_virtual)
+    xform.op = TJXOP_NONE;
+
+  ret = gst_caps_copy (caps);
+  if (direction == GST_PAD_SINK) {
+    for (i = 0; i < gst_caps_get_size (ret); i++) {
+      GstStructure *s = gst_caps_get_structure (ret, i);
+      tjtransform frame_xform = xform;
+      gint width, height;
+
+      GST_OBJECT_LOCK (self);
+      if (self->ops->len > 0 && !per_buffer
+          && gst_structure_get_int (s, "width", &width)
+          && gst_structure_get_int (s, "height", &height))
+        gst_jpegtran_compose_ops (self->ops, width, height, &frame_xform);
+      GST_OBJECT_UNLOCK (self);
+
+      gst_jpegtran_transform_structure (s, &frame_xform);
+    }
+  } else {
+    for (i = 0; i < gst_caps_get_size (ret); i++)
+      gst_jpegtran_untransform_structure (gst_caps_get_structure (ret, i),
+          &xform);
+  }
+
+  if (filter) {
+    GstCaps *tmp = gst_caps_intersect_full (filter, ret,
+        GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref (ret);
+    ret = tmp;
+  }
+
+  GST_DEBUG_OBJECT (self, "transformed %" GST_PTR_FORMAT " into %"
+      GST_PTR_FORMAT, caps, ret);
+
+  return ret;
+}
+
+static gboolean
+gst_jpegtran_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstStructure *s = gst_caps_get_structure (incaps, 0);
+  gint width, height, fps_n, fps_d;
+  gboolean parsed, framing;
+
+  /* without dimensions in the caps the geometry is taken from the
+   * first frame instead */
+  if (gst_structure_get_int (s, "width", &width)
+      && gst_structure_get_int (s, "height", &height)) {
+    self->width = width;
+    self->height = height;
+    self->subsamp = gst_jpegtran_subsamp_from_caps (s);
+  }
+
+  /* unparsed input is a byte stream to cut into images first. Input
+   * that does not say usually has an image per buffer, as from
+   * multipartdemux or a single image file, and is only cut up once a
+   * buffer turns out not to be one */
+  if (gst_structure_get_boolean (s, "parsed", &parsed)) {
+    framing = !parsed;
+    self->may_frame = FALSE;
+  } else {
+    framing = FALSE;
+    self->may_frame = TRUE;
+  }
+  if (self->framing && !framing)
+    gst_jpegtran_reset_framing (self);
+  self->framing = framing;
+
+  if (gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d)
+      && fps_n > 0 && fps_d > 0)
+    self->frame_duration = gst_util_uint64_scale_int (GST_SECOND, fps_d,
+        fps_n);
+  else
+    self->frame_duration = GST_CLOCK_TIME_NONE;
+
+  GST_DEBUG_OBJECT (self, "framing %s", framing ? "on" : "off");
+
+  return TRUE;
+}
+
+static gboolean
+gst_jpegtran_transform_size (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, gsize size,
+    GstCaps * othercaps, gsize * othersize)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+
+  if (direction == GST_PAD_SRC)
+    return FALSE;
+
+  *othersize = gst_jpegtran_predict_size (self, size);
+
+  return TRUE;
+}
+
+/* make sure there is a pool holding buffers large enough for the
+ * predicted output of the largest input seen so far, the base class
+ * configures and activates it */
+static gboolean
+gst_jpegtran_decide_allocation (GstBaseTransform * trans, GstQuery * query)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstBufferPool *pool = NULL;
+  guint size = 0, min = 0, max = 0;
+  gsize needed;
+
+  /* leave some room for the stream to grow before renegotiating */
+  needed = self->max_insize > 0 ?
+      gst_jpegtran_predict_size (self,
+      self->max_insize + self->max_insize / 8) : 0;
+
+  if (needed > 0) {
+    if (gst_query_get_n_allocation_pools (query) > 0) {
+      gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min,
+          &max);
+      size = MAX (size, needed);
+      /* every frame in flight or queued holds an output buffer */
+      min = MAX (min, self->n_workers * JOBS_PER_WORKER +
+          (self->ring ? self->queue_frames : 0));
+      if (max != 0 && max < min)
+        max = min;
+      gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+    } else {
+      size = needed;
+      pool = gst_buffer_pool_new ();
+      gst_query_add_allocation_pool (query, pool, size, 0, 0);
+    }
+    if (pool)
+      gst_object_unref (pool);
+  }
+  self->pool_size = size;
+
+  GST_DEBUG_OBJECT (self, "output buffer size %u, min %u, max %u", size,
+      min, max);
+
+  return GST_BASE_TRANSFORM_CLASS (parent_class)->decide_allocation (trans,
+      query);
+}
+
+static GstFlowReturn
+gst_jpegtran_prepare_output_buffer (GstBaseTransform * trans,
+    GstBuffer * inbuf, GstBuffer ** outbuf)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstMapInfo in_info;
+  GstFlowReturn ret;
+  gint width = 0, height = 0, jpegSubsamp = 0;
+  gsize needed, insize;
+
+  if (gst_base_transform_is_passthrough (trans))
+    return GST_BASE_TRANSFORM_CLASS (parent_class)->prepare_output_buffer
+        (trans, inbuf, outbuf);
+
+  insize = gst_buffer_get_size (inbuf);
+  if (!gst_jpegtran_map_header (inbuf, &in_info)) {
+    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("Unable to map memory"),
+        (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_jpegtran_frame_geometry (self, in_info.data, in_info.size, &width,
+          &height, &jpegSubsamp)) {
+    GST_ELEMENT_ERROR (self, STREAM, DECODE, ("cannot decompress header: "
+            "no supported SOF before SOS"), (NULL));
+    GST_OBJECT_LOCK (self);
+    self->stats_errors++;
+    GST_OBJECT_UNLOCK (self);
+    gst_buffer_unmap (inbuf, &in_info);
+    return GST_FLOW_ERROR;
+  }
+
+  GST_LOG_OBJECT (self,
+		  "width %d, height %d, subsamp %d, size %lu",
+		  width,height,jpegSubsamp,
+		  tjBufSize(width,
+			    height,
+			    jpegSubsamp)
+
+		  );
+
+  self->width = width;
+  self->height = height;
+  self->subsamp = jpegSubsamp;
+
+  /* renegotiate the pool for the next frame when this one outgrows it */
+  needed = gst_jpegtran_predict_size (self, insize);
+  self->max_insize = MAX (self->max_insize, insize);
+  gst_buffer_unmap (inbuf, &in_info);
+  if (needed > self->pool_size) {
+    GST_DEBUG_OBJECT (self, "frame needs %" G_GSIZE_FORMAT " bytes, pool "
+        "holds %" G_GSIZE_FORMAT, needed, self->pool_size);
+    gst_base_transform_reconfigure_src (trans);
+    *outbuf = gst_buffer_new_allocate (NULL, needed, NULL);
+    if (!GST_BASE_TRANSFORM_GET_CLASS (trans)->copy_metadata (trans, inbuf,
+            *outbuf)) {
+      gst_buffer_unref (*outbuf);
+      *outbuf = NULL;
+      return GST_FLOW_ERROR;
+    }
+    return GST_FLOW_OK;
+  }
+
+  ret = GST_BASE_TRANSFORM_CLASS (parent_class)->prepare_output_buffer
+      (trans, inbuf, outbuf);
+
+  return ret;
+}
+
+/* intra-frame parallel mode
+ *
+ * A baseline JPEG whose restart interval spans whole MCU rows can be cut
+ * at RST markers into horizontal stripes that are valid JPEGs on their
+ * own. Flips and rot180 keep the stripes horizontal, so every stripe is
+ * transformed separately and the results are stitched back together with
+ * fresh RST markers, bottom stripe first when flipping vertically. */
+
+static void
+gst_jpegtran_stripe_func (GstJpegTranTask * task, tjhandle handle,
+    gpointer user_data)
+{
+  GstJpegTranStripe *stripe = (GstJpegTranStripe *) task;
+  GstJpegTranStripeBatch *batch = stripe->batch;
+
+  stripe->ok = handle != NULL
+      && tjTransform (handle, stripe->in, stripe->in_size, 1, &stripe->out,
+      &stripe->out_size, &stripe->xform, 0) == 0
+      && gst_jpeg_parse_frame_info (stripe->out, stripe->out_size,
+      &stripe->out_info)
+      && stripe->out_size >= stripe->out_info.scan_offset + 2
+      && stripe->out[stripe->out_size - 1] == JPEG_MARKER_EOI;
+  if (!stripe->ok)
+    GST_DEBUG_OBJECT (user_data, "stripe transform failed: %s",
+        tjGetErrorStr2 (handle));
+
+  g_mutex_lock (&batch->lock);
+  if (--batch->pending == 0)
+    g_cond_signal (&batch->cond);
+  g_mutex_unlock (&batch->lock);
+}
+
+/* returns FALSE when the frame can not be split, the caller then does a
+ * plain tjTransform(). Like tjTransform(), replaces *dstBuf with a
+ * tjAlloc()ed buffer when the result does not fit */
+static gboolean
+gst_jpegtran_transform_stripes (Gstjpegtran * self, const guint8 * data,
+    gsize size, const tjtransform * xform, unsigned char **dstBuf,
+    unsigned long *dstSize)
+{
+  GstJpegFrameInfo info, *hdr;
+  GstJpegTranStripeBatch batch;
+  GstJpegTranStripe *stripes;
+  GArray *rst;
+  guint mcu_height, mcus_per_row, rows, n_intervals, usable, per_stripe;
+  guint n_stripes, max_stripes, out_height, out_interval, out_mcu_height;
+  guint i, j;
+  gboolean flipped, ret = FALSE;
+  gsize offset, scan_end, total;
+  guint8 marker = 0;
+  guint8 *p;
+
+  switch (xform->op) {
+    case TJXOP_NONE:
+    case TJXOP_HFLIP:
+      flipped = FALSE;
+      break;
+    case TJXOP_VFLIP:
+    case TJXOP_ROT180:
+      flipped = TRUE;
+      break;
+    default:
+      return FALSE;
+  }
+  /* untrimmed partial MCUs stay in place and would end up inside the
+   * image after reordering */
+  if (!(xform->options & TJXOPT_TRIM)
+      || (xform->options & ~(TJXOPT_TRIM | TJXOPT_GRAY | TJXOPT_COPYNONE)))
+    return FALSE;
+
+  if (!gst_jpeg_parse_frame_info (data, size, &info)
+      || !gst_jpeg_frame_info_is_baseline (&info)
+      || info.scan_components != info.n_components
+      || info.restart_interval == 0)
+    return FALSE;
+
+  mcus_per_row = gst_jpeg_frame_info_mcus_per_row (&info);
+  if (info.restart_interval % mcus_per_row != 0)
+    return FALSE;
+  rows = info.restart_interval / mcus_per_row;
+  mcu_height = gst_jpeg_frame_info_mcu_height (&info);
+  n_intervals = ((info.height + mcu_height - 1) / mcu_height + rows - 1)
+      / rows;
+
+  /* a partial MCU row at the bottom is trimmed away by a vertical flip,
+   * every stripe but the last has to be equally high after reordering */
+  if (flipped) {
+    if ((info.height / mcu_height) % rows != 0)
+      return FALSE;
+    usable = (info.height / mcu_height) / rows;
+  } else {
+    usable = n_intervals;
+  }
+
+  max_stripes = MIN (self->n_stripe_workers,
+      (guint64) info.width * info.height / STRIPE_MIN_PIXELS);
+  if (max_stripes < 2 || usable < 2)
+    return FALSE;
+
+  per_stripe = (usable + max_stripes - 1) / max_stripes;
+  while (flipped && usable % per_stripe != 0)
+    per_stripe++;
+  n_stripes = (usable + per_stripe - 1) / per_stripe;
+  if (n_stripes < 2 || mcus_per_row * rows * per_stripe > G_MAXUINT16)
+    return FALSE;
+
+  /* find the restart markers, the one after interval i is rst[i] */
+  rst = g_array_sized_new (FALSE, FALSE, sizeof (gsize), n_intervals);
+  offset = info.scan_offset;
+  while ((offset = gst_jpeg_next_marker (data, size, offset, &marker)) < size
+      && JPEG_MARKER_IS_RST (marker)) {
+    g_array_append_val (rst, offset);
+    offset += 2;
+  }
+  scan_end = offset;
+  if (scan_end >= size || marker != JPEG_MARKER_EOI
+      || rst->len != n_intervals - 1) {
+    GST_DEBUG_OBJECT (self, "found %u restart markers, expected %u",
+        rst->len, n_intervals - 1);
+    g_array_free (rst, TRUE);
+    return FALSE;
+  }
+
+  GST_LOG_OBJECT (self, "%u intervals of %u MCU rows in %u stripes",
+      n_intervals, rows, n_stripes);
+
+  g_mutex_init (&batch.lock);
+  g_cond_init (&batch.cond);
+  batch.pending = n_stripes;
+
+  stripes = g_new0 (GstJpegTranStripe, n_stripes);
+  for (i = 0; i < n_stripes; i++) {
+    GstJpegTranStripe *stripe = &stripes[i];
+    guint first = i * per_stripe;
+    guint last = i == n_stripes - 1 ? n_intervals : first + per_stripe;
+    gsize start = first == 0 ? info.scan_offset :
+        g_array_index (rst, gsize, first - 1) + 2;
+    gsize end = last == n_intervals ? scan_end :
+        g_array_index (rst, gsize, last - 1);
+    guint top = first * rows * mcu_height;
+
+    stripe->in_size = info.scan_offset + (end - start) + 2;
+    stripe->in = g_malloc (stripe->in_size);
+    memcpy (stripe->in, data, info.scan_offset);
+    GST_WRITE_UINT16_BE (stripe->in + info.sof_offset + 5,
+        MIN (info.height - top, (last - first) * rows * mcu_height));
+    memcpy (stripe->in + info.scan_offset, data + start, end - start);
+    /* restart numbering starts over in every stripe */
+    for (j = first; j + 1 < last; j++)
+      stripe->in[info.scan_offset + g_array_index (rst, gsize, j) - start + 1]
+          = JPEG_MARKER_RST0 + ((j - first) & 7);
+    stripe->in[stripe->in_size - 2] = 0xFF;
+    stripe->in[stripe->in_size - 1] = JPEG_MARKER_EOI;
+
+    /* only the stripe providing the output header needs the markers */
+    stripe->xform = *xform;
+    if (i > 0)
+      stripe->xform.options |= TJXOPT_COPYNONE;
+    stripe->batch = &batch;
+    stripe->task.func = gst_jpegtran_stripe_func;
+    stripe->task.user_data = self;
+
+    gst_jpegtran_pool_push_stripe (&stripe->task);
+  }
+  g_array_free (rst, TRUE);
+
+  g_mutex_lock (&batch.lock);
+  while (batch.pending > 0)
+    g_cond_wait (&batch.cond, &batch.lock);
+  g_mutex_unlock (&batch.lock);
+
+  out_height = 0;
+  total = 0;
+  for (i = 0; i < n_stripes; i++) {
+    if (!stripes[i].ok)
+      goto done;
+    out_height += stripes[i].out_info.height;
+    total += stripes[i].out_size - stripes[i].out_info.scan_offset - 2;
+  }
+
+  /* the interval in output MCUs, TJXOPT_GRAY turns the 16 pixel rows
+   * of subsampled input into 8 pixel rows */
+  hdr = &stripes[0].out_info;
+  out_mcu_height = gst_jpeg_frame_info_mcu_height (hdr);
+  for (i = 0; i + 1 < n_stripes; i++) {
+    const GstJpegFrameInfo *out = &stripes[flipped ? n_stripes - 1 - i :
+        i].out_info;
+
+    if (out->height != hdr->height || out->height % out_mcu_height != 0)
+      goto done;
+  }
+  out_interval = gst_jpeg_frame_info_mcus_per_row (hdr) *
+      (hdr->height / out_mcu_height);
+  if (out_interval > G_MAXUINT16 || out_height > G_MAXUINT16)
+    goto done;
+
+  /* header, DRI, entropy data, RST markers in between and EOI */
+  total += hdr->scan_offset + (hdr->dri_offset ? 0 : 6)
+      + 2 * (n_stripes - 1) + 2;
+  if (total > *dstSize) {
+    if (total > G_MAXINT)
+      goto done;
+    *dstBuf = tjAlloc (total);
+    if (*dstBuf == NULL)
+      goto done;
+  }
+
+  p = *dstBuf;
+  memcpy (p, stripes[0].out, hdr->sos_offset);
+  GST_WRITE_UINT16_BE (p + hdr->sof_offset + 5, out_height);
+  if (hdr->dri_offset) {
+    GST_WRITE_UINT16_BE (p + hdr->dri_offset + 4, out_interval);
+    p += hdr->sos_offset;
+  } else {
+    p += hdr->sos_offset;
+    p[0] = 0xFF;
+    p[1] = JPEG_MARKER_DRI;
+    GST_WRITE_UINT16_BE (p + 2, 4);
+    GST_WRITE_UINT16_BE (p + 4, out_interval);
+    p += 6;
+  }
+  memcpy (p, stripes[0].out + hdr->sos_offset,
+      hdr->scan_offset - hdr->sos_offset);
+  p += hdr->scan_offset - hdr->sos_offset;
+
+  for (i = 0; i < n_stripes; i++) {
+    GstJpegTranStripe *stripe = &stripes[flipped ? n_stripes - 1 - i : i];
+    gsize len = stripe->out_size - stripe->out_info.scan_offset - 2;
+
+    if (i > 0) {
+      p[0] = 0xFF;
+      p[1] = JPEG_MARKER_RST0 + ((i - 1) & 7);
+      p += 2;
+    }
+    memcpy (p, stripe->out + stripe->out_info.scan_offset, len);
+    p += len;
+  }
+  p[0] = 0xFF;
+  p[1] = JPEG_MARKER_EOI;
+
+  *dstSize = total;
+  ret = TRUE;
+
+done:
+  for (i = 0; i < n_stripes; i++) {
+    g_free (stripes[i].in);
+    if (stripes[i].out)
+      tjFree (stripes[i].out);
+  }
+  g_free (stripes);
+  g_mutex_clear (&batch.lock);
+  g_cond_clear (&batch.cond);
+
+  return ret;
+}
+
+/* copy-markers */
+
+static gboolean
+gst_jpegtran_keep_marker (GstJpegTranCopyMarkers copy, guint32 mask,
+    const GstJpegSegment * seg)
+{
+  if (copy == GST_JPEGTRAN_COPY_MARKERS_ICC)
+    return seg->marker == JPEG_MARKER_APP2 && seg->length >= 12
+        && memcmp (seg->data, "ICC_PROFILE", 12) == 0;
+
+  if (seg->marker == JPEG_MARKER_COM)
+    return (mask & MARKER_MASK_COM) != 0;
+  if (seg->marker < JPEG_MARKER_APP0 || seg->marker > JPEG_MARKER_APP15)
+    return FALSE;
+  /* libjpeg writes these itself */
+  if (seg->marker == JPEG_MARKER_APP0 && seg->length >= 5
+      && memcmp (seg->data, "JFIF", 5) == 0)
+    return FALSE;
+  if (seg->marker == JPEG_MARKER_APP14 && seg->length >= 5
+      && memcmp (seg->data, "Adobe", 5) == 0)
+    return FALSE;
+
+  return (mask & (1 << (seg->marker - JPEG_MARKER_APP0))) != 0;
+}
+
+/* xop=auto */
+
+/* indexed by EXIF Orientation - 1 */
+static const GstJpegTranXop exif_orientation_xops[] = {
+  TJXOP_NONE, TJXOP_HFLIP, TJXOP_ROT180, TJXOP_VFLIP,
+  TJXOP_TRANSPOSE, TJXOP_ROT90, TJXOP_TRANSVERSE, TJXOP_ROT270
+};
+
+static const struct
+{
+  const gchar *tag;
+  GstJpegTranXop xop;
+} orientation_tag_xops[] = {
+  {"rotate-0", TJXOP_NONE},
+  {"rotate-90", TJXOP_ROT90},
+  {"rotate-180", TJXOP_ROT180},
+  {"rotate-270", TJXOP_ROT270},
+  {"flip-rotate-0", TJXOP_HFLIP},
+  {"flip-rotate-90", TJXOP_TRANSVERSE},
+  {"flip-rotate-180", TJXOP_VFLIP},
+  {"flip-rotate-270", TJXOP_TRANSPOSE}
+};
+
+/* the xop that makes a frame upright, from its EXIF Orientation or else
+ * the last image-orientation tag */
+static GstJpegTranXop
+gst_jpegtran_auto_xop (Gstjpegtran * self, const guint8 * data, gsize size)
+{
+  GstJpegExifOrientation orientation;
+  GstJpegTranXop xop;
+
+  if (gst_jpeg_find_exif_orientation (data, size, &orientation)
+      && orientation.value >= 1 && orientation.value <= 8)
+    return exif_orientation_xops[orientation.value - 1];
+
+  GST_OBJECT_LOCK (self);
+  xop = self->tag_xop;
+  GST_OBJECT_UNLOCK (self);
+
+  return xop;
+}
+
+/* an auto-rotated frame is upright, tell its EXIF data so */
+static void
+gst_jpegtran_reset_exif_orientation (guint8 * data, gsize size)
+{
+  GstJpegExifOrientation orientation;
+
+  if (gst_jpeg_find_exif_orientation (data, size, &orientation)
+      && orientation.value != 1)
+    gst_jpeg_write_exif_orientation (data, &orientation, 1);
+}
+
+/* the tags with image-orientation rotate-0, the output of auto is
+ * upright */
+static GstEvent *
+gst_jpegtran_upright_tag_event (GstTagList * taglist)
+{
+  taglist = gst_tag_list_copy (taglist);
+  gst_tag_list_add (taglist, GST_TAG_MERGE_REPLACE,
+      GST_TAG_IMAGE_ORIENTATION, "rotate-0", NULL);
+
+  return gst_event_new_tag (taglist);
+}
+
+/* remember the orientation of the stream, and when the xop property or
+ * a GstJpegTranMeta picked auto replace the tag by rotate-0 */
+static GstEvent *
+gst_jpegtran_handle_orientation_tag (Gstjpegtran * self, GstEvent * event)
+{
+  GstTagList *taglist;
+  gchar *orientation;
+  gboolean is_auto;
+  guint i;
+
+  gst_event_parse_tag (event, &taglist);
+  if (!gst_tag_list_get_string (taglist, GST_TAG_IMAGE_ORIENTATION,
+          &orientation))
+    return event;
+
+  GST_OBJECT_LOCK (self);
+  for (i = 0; i < G_N_ELEMENTS (orientation_tag_xops); i++) {
+    if (g_str_equal (orientation, orientation_tag_xops[i].tag)) {
+      self->tag_xop = orientation_tag_xops[i].xop;
+      break;
+    }
+  }
+  is_auto = self->xop == GST_JPEGTRAN_XOP_AUTO || self->meta_auto;
+  /* a later auto meta still has to rewrite them */
+  gst_clear_tag_list (&self->orientation_tags);
+  if (!is_auto)
+    self->orientation_tags = gst_tag_list_ref (taglist);
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "image-orientation %s", orientation);
+  g_free (orientation);
+
+  if (is_auto) {
+    GstEvent *upright = gst_jpegtran_upright_tag_event (taglist);
+
+    gst_event_unref (event);
+    event = upright;
+  }
+
+  return event;
+}
+
+/* virtual-rotation */
+
+static guint
+gst_jpegtran_xop_to_exif_orientation (GstJpegTranXop xop)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (exif_orientation_xops); i++)
+    if (exif_orientation_xops[i] == xop)
+      return i + 1;
+
+  return 1;
+}
+
+/* splicing
+ *
+ * When the coefficients stay where they are the output is a rewritten
+ * header in a memory of its own, followed by the input's scan data
+ * shared as is. Covers marker filtering with xop=none, xop=auto on an
+ * upright frame and virtual-rotation. */
+
+typedef struct
+{
+  GstJpegTranXop xop;
+  gboolean is_virtual;
+  GstJpegTranCopyMarkers copy_markers;
+  guint32 marker_mask;
+} GstJpegTranSplice;
+
+static gboolean
+gst_jpegtran_get_splice (Gstjpegtran * self, GstBuffer * inbuf,
+    GstJpegTranSplice * splice)
+{
+  GstJpegTranXop meta_xop;
+  gboolean ret, has_meta;
+
+  has_meta = gst_jpegtran_buffer_get_xop (inbuf, &meta_xop);
+
+  GST_OBJECT_LOCK (self);
+  splice->xop = has_meta ? meta_xop : self->xop;
+  splice->is_virtual = self->virtual_rotation
+      && splice->xop != GST_JPEGTRAN_XOP_AUTO;
+  splice->copy_markers = self->copy_markers;
+  splice->marker_mask = self->marker_mask;
+  ret = gst_jpegtran_can_splice_unlocked (self, splice->xop, has_meta,
+      splice->is_virtual);
+  GST_OBJECT_UNLOCK (self);
+
+  return ret;
+}
+
+static gboolean
+gst_jpegtran_splice_keeps (const GstJpegTranSplice * splice,
+    const GstJpegSegment * seg)
+{
+  if (splice->copy_markers == GST_JPEGTRAN_COPY_MARKERS_ALL)
+    return TRUE;
+  /* tables, frame header and whatever libjpeg would write itself */
+  if ((seg->marker < JPEG_MARKER_APP0 || seg->marker > JPEG_MARKER_APP15)
+      && seg->marker != JPEG_MARKER_COM)
+    return TRUE;
+  if (seg->marker == JPEG_MARKER_APP0 && seg->length >= 5
+      && memcmp (seg->data, "JFIF", 5) == 0)
+    return TRUE;
+  if (seg->marker == JPEG_MARKER_APP14 && seg->length >= 5
+      && memcmp (seg->data, "Adobe", 5) == 0)
+    return TRUE;
+
+  return gst_jpegtran_keep_marker (splice->copy_markers, splice->marker_mask,
+      seg);
+}
+
+/* Returns GST_FLOW_CUSTOM_SUCCESS when the frame needs tjTransform()
+ * after all. */
+static GstFlowReturn
+gst_jpegtran_splice (Gstjpegtran * self, GstBuffer * inbuf,
+    const GstJpegTranSplice * splice, GstBuffer ** outbuf)
+{
+  GstJpegExifOrientation orientation;
+  GstJpegSegment seg;
+  GstJpegTranXop xop = splice->xop;
+  GstMapInfo info, mem_info;
+  GstMemory *mem;
+  gsize offset, sos, header_size, q, exif_offset = 0;
+  gboolean have_orientation, orientation_kept = FALSE, insert_exif;
+  guint value = 0, exif_added = 0;
+
+  /* everything after SOS is shared, not read */
+  if (!gst_jpegtran_map_header (inbuf, &info)) {
+    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("Unable to map memory"),
+        (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  if (xop == GST_JPEGTRAN_XOP_AUTO
+      && gst_jpegtran_auto_xop (self, info.data, info.size) != TJXOP_NONE)
+    goto no_splice;
+
+  have_orientation = gst_jpeg_find_exif_orientation (info.data, info.size,
+      &orientation);
+  if (splice->is_virtual) {
+    if (have_orientation && orientation.value >= 1 && orientation.value <= 8)
+      xop = gst_jpegtran_compose_xop (xop,
+          exif_orientation_xops[orientation.value - 1]);
+    value = gst_jpegtran_xop_to_exif_orientation (xop);
+  }
+
+  if (info.size < 4 || info.data[0] != 0xFF
+      || info.data[1] != JPEG_MARKER_SOI)
+    goto no_splice;
+
+  header_size = offset = 2;
+  while (gst_jpeg_next_segment (info.data, info.size, &offset, &seg)) {
+    if (!gst_jpegtran_splice_keeps (splice, &seg))
+      continue;
+    header_size += seg.size;
+    if (have_orientation && orientation.offset >= seg.offset
+        && orientation.offset < seg.offset + seg.size)
+      orientation_kept = TRUE;
+    if (exif_offset == 0 && gst_jpeg_segment_is_exif (&seg))
+      exif_offset = seg.offset;
+  }
+  /* anything the segment walk cannot make sense of is left to libjpeg */
+  sos = offset;
+  if (sos + 2 > info.size || info.data[sos + 1] != JPEG_MARKER_SOS)
+    goto no_splice;
+
+  /* readers only look at the first EXIF segment, one without an
+   * Orientation entry gets it added instead of a second segment */
+  insert_exif = value > 1 && !orientation_kept && exif_offset == 0;
+  if (insert_exif)
+    header_size += JPEG_EXIF_ORIENTATION_SEGMENT_SIZE;
+  if (value > 1 && !orientation_kept && exif_offset != 0) {
+    offset = exif_offset;
+    gst_jpeg_next_segment (info.data, info.size, &offset, &seg);
+    exif_added = gst_jpeg_exif_add_orientation_size (&seg);
+    if (exif_added == 0)
+      goto no_splice;
+    header_size += exif_added;
+  }
+
+  mem = gst_allocator_alloc (NULL, header_size, NULL);
+  gst_memory_map (mem, &mem_info, GST_MAP_WRITE);
+  memcpy (mem_info.data, info.data, 2);
+  q = 2;
+
+  offset = 2;
+  while (gst_jpeg_next_segment (info.data, info.size, &offset, &seg)) {
+    /* after SOI and a JFIF APP0, which wants to come first */
+    if (insert_exif && seg.marker != JPEG_MARKER_APP0) {
+      gst_jpeg_write_exif_orientation_segment (mem_info.data + q, value);
+      q += JPEG_EXIF_ORIENTATION_SEGMENT_SIZE;
+      insert_exif = FALSE;
+    }
+    if (!gst_jpegtran_splice_keeps (splice, &seg))
+      continue;
+
+    if (exif_added > 0 && seg.offset == exif_offset) {
+      gst_jpeg_write_exif_add_orientation (mem_info.data + q, &seg, value);
+      q += seg.size + exif_added;
+      continue;
+    }
+    memcpy (mem_info.data + q, info.data + seg.offset, seg.size);
+    if (value > 0 && orientation_kept && orientation.offset >= seg.offset
+        && orientation.offset < seg.offset + seg.size) {
+      GstJpegExifOrientation moved = orientation;
+
+      moved.offset = q + orientation.offset - seg.offset;
+      gst_jpeg_write_exif_orientation (mem_info.data, &moved, value);
+    }
+    q += seg.size;
+  }
+  if (insert_exif)
+    gst_jpeg_write_exif_orientation_segment (mem_info.data + q, value);
+  gst_memory_unmap (mem, &mem_info);
+  gst_buffer_unmap (inbuf, &info);
+
+  *outbuf = gst_buffer_new ();
+  gst_buffer_append_memory (*outbuf, mem);
+  gst_buffer_copy_into (*outbuf, inbuf, GST_BUFFER_COPY_MEMORY, sos, -1);
+  gst_buffer_copy_into (*outbuf, inbuf, GST_BUFFER_COPY_METADATA, 0, -1);
+  gst_jpegtran_remove_meta (*outbuf);
+
+  GST_LOG_OBJECT (self, "spliced %" G_GSIZE_FORMAT " byte header, EXIF "
+      "orientation %u", header_size, value);
+
+  return GST_FLOW_OK;
+
+no_splice:
+  gst_buffer_unmap (inbuf, &info);
+  return GST_FLOW_CUSTOM_SUCCESS;
+}
+
+/* snapshot the transforms of the request pads for one frame, NULL when
+ * there are none */
+static GstJpegTranOutput *
+gst_jpegtran_get_extra_outputs (Gstjpegtran * self, guint * n_extra)
+{
+  GstJpegTranOutput *extra;
+  GList *l;
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  *n_extra = g_list_length (self->extra_pads);
+  if (*n_extra == 0) {
+    GST_OBJECT_UNLOCK (self);
+    return NULL;
+  }
+  extra = g_new0 (GstJpegTranOutput, *n_extra);
+  for (l = self->extra_pads, i = 0; l != NULL; l = l->next, i++)
+    extra[i].pad = gst_object_ref (l->data);
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; i < *n_extra; i++)
+    gst_jpegtran_pad_get_xform (extra[i].pad, &extra[i].xform);
+
+  return extra;
+}
+
+static void
+gst_jpegtran_free_extra_outputs (GstJpegTranOutput * extra, guint n_extra)
+{
+  guint i;
+
+  for (i = 0; i < n_extra; i++) {
+    if (extra[i].outbuf)
+      gst_buffer_unref (extra[i].outbuf);
+    gst_object_unref (extra[i].pad);
+  }
+  g_free (extra);
+}
+
+/* push the request pad outputs of one frame, a pad that is not linked or
+ * already saw EOS does not stop the others */
+static GstFlowReturn
+gst_jpegtran_push_extra_outputs (Gstjpegtran * self,
+    GstJpegTranOutput * extra, guint n_extra)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i;
+
+  for (i = 0; i < n_extra; i++) {
+    GstFlowReturn pad_ret;
+    gboolean caps_changed;
+
+    if (extra[i].outbuf == NULL)
+      continue;
+
+    GST_OBJECT_LOCK (extra[i].pad);
+    caps_changed = extra[i].pad->caps_changed;
+    GST_OBJECT_UNLOCK (extra[i].pad);
+    /* a RECONFIGURE from downstream flags the pad, the caps stay but the
+     * pool may not */
+    if (gst_pad_check_reconfigure (GST_PAD (extra[i].pad)) && !caps_changed) {
+      GstCaps *caps = gst_pad_get_current_caps (GST_PAD (extra[i].pad));
+
+      if (caps) {
+        gst_jpegtran_pad_query_allocation (extra[i].pad, caps);
+        gst_caps_unref (caps);
+      }
+    }
+    if (caps_changed) {
+      GstCaps *caps =
+          gst_pad_get_current_caps (GST_BASE_TRANSFORM_SINK_PAD (self));
+
+      if (caps) {
+        gst_jpegtran_pad_push_caps (extra[i].pad, caps);
+        gst_caps_unref (caps);
+      }
+    }
+
+    pad_ret = gst_pad_push (GST_PAD (extra[i].pad), extra[i].outbuf);
+    extra[i].outbuf = NULL;
+
+    if (pad_ret == GST_FLOW_FLUSHING || pad_ret <= GST_FLOW_NOT_NEGOTIATED) {
+      GST_DEBUG_OBJECT (extra[i].pad, "push returned %s",
+          gst_flow_get_name (pad_ret));
+      if (ret == GST_FLOW_OK)
+        ret = pad_ret;
+    }
+  }
+
+  return ret;
+}
+
+/* copy the APPn and COM segments of src picked by copy-markers into the
+ * output of a TJXOPT_COPYNONE transform, after the SOI and the JFIF or
+ * Adobe segments libjpeg wrote. The output moves to a new tjAlloc()'d
+ * buffer when it does not fit in capacity, the old one is tjFree()'d
+ * when owned. */
+static void
+gst_jpegtran_copy_markers (GstJpegTranCopyMarkers copy, guint32 mask,
+    const guint8 * src, gsize src_size, unsigned char **dst,
+    unsigned long *dst_size, gsize capacity, gboolean owned)
+{
+  GstJpegSegment seg;
+  gsize offset, insert, total = 0;
+  guint8 *p, *q;
+
+  offset = 2;
+  while (gst_jpeg_next_segment (src, src_size, &offset, &seg))
+    if (gst_jpegtran_keep_marker (copy, mask, &seg))
+      total += seg.size;
+  if (total == 0)
+    return;
+
+  insert = offset = 2;
+  while (gst_jpeg_next_segment (*dst, *dst_size, &offset, &seg)
+      && (seg.marker == JPEG_MARKER_APP0 || seg.marker == JPEG_MARKER_APP14))
+    insert = offset;
+
+  if (*dst_size + total <= capacity) {
+    p = *dst;
+    memmove (p + insert + total, p + insert, *dst_size - insert);
+  } else {
+    p = tjAlloc (*dst_size + total);
+    if (p == NULL)
+      return;
+    memcpy (p, *dst, insert);
+    memcpy (p + insert + total, *dst + insert, *dst_size - insert);
+    if (owned)
+      tjFree (*dst);
+    *dst = p;
+  }
+
+  q = p + insert;
+  offset = 2;
+  while (gst_jpeg_next_segment (src, src_size, &offset, &seg)) {
+    if (gst_jpegtran_keep_marker (copy, mask, &seg)) {
+      memcpy (q, src + seg.offset, seg.size);
+      q += seg.size;
+    }
+  }
+  *dst_size += total;
+}
+
+/* transform one frame with the given tjInitTransform() handle, safe to
+ * call from the worker threads. The request pad outputs in extra are
+ * produced by the same tjTransform() call, which decodes the input
+ * only once. */
+static GstFlowReturn
+gst_jpegtran_do_transform (Gstjpegtran * self, tjhandle handle,
+    GstBuffer * inbuf, GstBuffer * outbuf, const GstJpegTranConfig * config,
+    GstJpegTranOutput * extra, guint n_extra)
+{
+  GstMapInfo in_info;
+  GstMapInfo out_info;
+  GstMapInfo *extra_info;
+  gsize extra_size;
+  guint i, n_mapped;
+  GstClockTime duration;
+  gint64 start;
+
+  tjtransform *xforms = g_newa (tjtransform, 1 + n_extra);
+  xforms[0] = config->xform;
+  for (i = 0; i < n_extra; i++)
+    xforms[1 + i] = extra[i].xform;
+  /* let libturbojpeg grow into a buffer of its own when the prediction
+   * was too small */
+  int flags = 0;
+
+  if (!gst_buffer_map (inbuf, &in_info, GST_MAP_READ)) {
+    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("Unable to map memory"),
+        (NULL));
+    return GST_FLOW_ERROR;
+  }
+
+  if (!gst_buffer_map (outbuf, &out_info, GST_MAP_WRITE)) {
+    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, ("Unable to map memory"),
+        (NULL));
+    gst_buffer_unmap (inbuf, &in_info);
+    return GST_FLOW_ERROR;
+  }
+
+  gboolean *auto_xop = g_newa (gboolean, 1 + n_extra);
+  for (i = 0; i < 1 + n_extra; i++) {
+    auto_xop[i] = xforms[i].op == GST_JPEGTRAN_XOP_AUTO;
+    if (auto_xop[i])
+      xforms[i].op = gst_jpegtran_auto_xop (self, in_info.data,
+          in_info.size);
+  }
+
+  unsigned char **dstBufs = g_newa (unsigned char *, 1 + n_extra);
+  unsigned long *dstSizes = g_newa (unsigned long, 1 + n_extra);
+  dstBufs[0] = out_info.data;
+  dstSizes[0] = out_info.size;
+
+  extra_info = g_newa (GstMapInfo, n_extra + 1);
+  n_mapped = 0;
+  if (n_extra > 0 || (xforms[0].options & TJXOPT_CROP)) {
+    GstJpegFrameInfo frame;
+    gint width, height, subsamp = -1;
+
+    /* crop regions are checked against this frame, not the caps */
+    if (gst_jpeg_parse_frame_info (in_info.data, in_info.size, &frame))
+      subsamp = gst_jpegtran_subsamp_from_info (&frame);
+    if (subsamp >= 0) {
+      width = frame.width;
+      height = frame.height;
+    } else {
+      width = self->width;
+      height = self->height;
+      subsamp = self->subsamp;
+    }
+
+    if (config->ops)
+      gst_jpegtran_compose_ops (config->ops, width, height, &xforms[0]);
+    gst_jpegtran_snap_crop (&xforms[0], width, height, subsamp);
+    extra_size = gst_jpegtran_predict_size (self, in_info.size);
+    for (i = 0; i < n_extra; i++, n_mapped++) {
+      gst_jpegtran_snap_crop (&xforms[1 + i], width, height, subsamp);
+
+      extra[i].outbuf = gst_jpegtran_pad_alloc (extra[i].pad, extra_size);
+      if (extra[i].outbuf == NULL
+          || !gst_buffer_map (extra[i].outbuf, &extra_info[i],
+              GST_MAP_WRITE))
+        break;
+      dstBufs[1 + i] = extra_info[i].data;
+      dstSizes[1 + i] = extra_info[i].size;
+    }
+  }
+
+  if (n_mapped < n_extra) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED,
+        ("Unable to allocate output for %s",
+            GST_OBJECT_NAME (extra[n_mapped].pad)), (NULL));
+    goto fail;
+  }
+
+  start = g_get_monotonic_time ();
+  if (n_extra == 0 && self->n_stripe_workers > 1
+      && gst_jpegtran_transform_stripes (self, in_info.data, in_info.size,
+          &xforms[0], dstBufs, dstSizes)) {
+    GST_LOG_OBJECT (self, "transformed in stripes");
+  } else if(tjTransform(handle,
+		 in_info.data,
+		 in_info.size,
+		 1 + n_extra,
+		 dstBufs,
+		 dstSizes,
+		 xforms, flags) < 0) {
+    GST_ELEMENT_ERROR (self, STREAM, FAILED, ("tjTransform failed"),
+		       ("%s", tjGetErrorStr2 (handle)));
+    goto fail;
+  }
+
+  if (xforms[0].options & TJXOPT_COPYNONE) {
+    GstJpegTranCopyMarkers copy;
+    guint32 mask;
+
+    GST_OBJECT_LOCK (self);
+    copy = self->copy_markers;
+    mask = self->marker_mask;
+    GST_OBJECT_UNLOCK (self);
+
+    if (copy != GST_JPEGTRAN_COPY_MARKERS_NONE)
+      gst_jpegtran_copy_markers (copy, mask, in_info.data, in_info.size,
+          &dstBufs[0], &dstSizes[0], dstBufs[0] == out_info.data ?
+          out_info.size : dstSizes[0], dstBufs[0] != out_info.data);
+  }
+
+  duration = (g_get_monotonic_time () - start) * GST_USECOND;
+
+  for (i = 0; i < 1 + n_extra; i++)
+    if (auto_xop[i])
+      gst_jpegtran_reset_exif_orientation (dstBufs[i], dstSizes[i]);
+
+  GST_LOG_OBJECT (self,
+		  "in %" G_GSIZE_FORMAT " dstSizes[0] %lu delta %ld",
+		  in_info.size,
+		  dstSizes[0],
+		  (long) (dstSizes[0]-in_info.size)
+		  );
+
+  gst_buffer_unmap (inbuf, &in_info);
+  gst_buffer_unmap (outbuf, &out_info);
+
+  for (i = 0; i < n_extra; i++) {
+    gst_buffer_unmap (extra[i].outbuf, &extra_info[i]);
+    if (dstBufs[1 + i] != extra_info[i].data) {
+      gst_buffer_replace_all_memory (extra[i].outbuf,
+          gst_memory_new_wrapped (0, dstBufs[1 + i], dstSizes[1 + i], 0,
+              dstSizes[1 + i], dstBufs[1 + i], (GDestroyNotify) tjFree));
+    } else {
+      gst_buffer_resize (extra[i].outbuf, 0, dstSizes[1 + i]);
+    }
+    gst_buffer_copy_into (extra[i].outbuf, inbuf, GST_BUFFER_COPY_METADATA,
+        0, -1);
+    gst_jpegtran_remove_meta (extra[i].outbuf);
+  }
+
+  if (dstBufs[0] != out_info.data) {
+    GST_DEBUG_OBJECT (self, "output of %lu bytes overran the %" G_GSIZE_FORMAT
+        " byte buffer", dstSizes[0], out_info.size);
+    gst_buffer_replace_all_memory (outbuf,
+        gst_memory_new_wrapped (0, dstBufs[0], dstSizes[0], 0, dstSizes[0],
+            dstBufs[0], (GDestroyNotify) tjFree));
+    GST_OBJECT_LOCK (self);
+    self->predict_misses++;
+  } else {
+    /* pooled buffers get their full size back when released */
+    gst_buffer_resize (outbuf, 0, dstSizes[0]);
+    GST_OBJECT_LOCK (self);
+    self->predict_hits++;
+  }
+  gst_jpegtran_update_ratio (self, in_info.size, dstSizes[0]);
+  if (xforms[0].options & ENTROPY_OPTIONS) {
+    self->bytes_saved += (gint64) in_info.size - (gint64) dstSizes[0];
+    self->coding_time += duration;
+  }
+  gst_jpegtran_update_stats_unlock (self, in_info.size, dstSizes[0],
+      out_info.size, duration);
+
+  /* let the application decide whether the extra pass pays off */
+  if (xforms[0].options & ENTROPY_OPTIONS) {
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self),
+            gst_structure_new ("GstJpegTranCost",
+                "timestamp", G_TYPE_UINT64, GST_BUFFER_PTS (inbuf),
+                "in-size", G_TYPE_UINT64, (guint64) in_info.size,
+                "out-size", G_TYPE_UINT64, (guint64) dstSizes[0],
+                "saved", G_TYPE_INT64,
+                (gint64) in_info.size - (gint64) dstSizes[0],
+                "duration", G_TYPE_UINT64, duration, NULL)));
+  }
+
+  return GST_FLOW_OK;
+
+fail:
+  GST_OBJECT_LOCK (self);
+  self->stats_errors++;
+  GST_OBJECT_UNLOCK (self);
+  gst_buffer_unmap (inbuf, &in_info);
+  gst_buffer_unmap (outbuf, &out_info);
+  /* output that outgrew our buffer was moved to one of libturbojpeg's */
+  if (dstBufs[0] != out_info.data)
+    tjFree (dstBufs[0]);
+  for (i = 0; i < n_mapped; i++) {
+    gst_buffer_unmap (extra[i].outbuf, &extra_info[i]);
+    if (dstBufs[1 + i] != extra_info[i].data)
+      tjFree (dstBufs[1 + i]);
+  }
+  for (i = 0; i < n_extra; i++)
+    gst_buffer_replace (&extra[i].outbuf, NULL);
+  return GST_FLOW_ERROR;
+}
+
+static GstFlowReturn
+gst_jpegtran_transform (GstBaseTransform * trans, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstJpegTranConfig config;
+  GstJpegTranOutput *extra;
+  guint n_extra;
+  GstFlowReturn ret;
+  tjhandle handle;
+
+  /* borrowed for the frame, one per stream would add up */
+  handle = self->list_handle ? self->list_handle :
+      gst_jpegtran_pool_get_handle ();
+  if (handle == NULL) {
+    GST_ELEMENT_ERROR (self, LIBRARY, INIT, ("cannot init transform"),
+        ("%s", tjGetErrorStr2 (NULL)));
+    return GST_FLOW_ERROR;
+  }
+
+  gst_jpegtran_get_xform (self, inbuf, &config.xform, &config.ops);
+  extra = gst_jpegtran_get_extra_outputs (self, &n_extra);
+  ret = gst_jpegtran_do_transform (self, handle, inbuf, outbuf,
+      &config, extra, n_extra);
+  if (handle != self->list_handle)
+    gst_jpegtran_pool_put_handle (handle);
+  if (config.ops)
+    g_array_unref (config.ops);
+  if (ret == GST_FLOW_OK)
+    ret = gst_jpegtran_push_extra_outputs (self, extra, n_extra);
+  if (extra)
+    gst_jpegtran_free_extra_outputs (extra, n_extra);
+
+  return ret;
+}
+
+static gboolean
+gst_jpegtran_transform_meta (GstBaseTransform * trans, GstBuffer * outbuf,
+    GstMeta * meta, GstBuffer * inbuf)
+{
+  /* the transform asked for is done */
+  if (gst_meta_info_is_custom (meta->info)
+      && gst_custom_meta_has_name ((GstCustomMeta *) meta, GST_JPEGTRAN_META))
+    return FALSE;
+
+  return GST_BASE_TRANSFORM_CLASS (parent_class)->transform_meta (trans,
+      outbuf, meta, inbuf);
+}
+
+/* QoS
+ *
+ * The base class drops frames that are late when they come in. Frames
+ * queued for the workers are checked again when a worker picks them up,
+ * against the last QoS event seen on the src pad. */
+
+static gboolean
+gst_jpegtran_is_late (Gstjpegtran * self, GstClockTime running_time)
+{
+  gboolean late;
+
+  if (!GST_CLOCK_TIME_IS_VALID (running_time)
+      || !gst_base_transform_is_qos_enabled (GST_BASE_TRANSFORM (self)))
+    return FALSE;
+
+  GST_OBJECT_LOCK (self);
+  late = GST_CLOCK_TIME_IS_VALID (self->earliest_time)
+      && running_time <= self->earliest_time;
+  GST_OBJECT_UNLOCK (self);
+
+  return late;
+}
+
+/* tell the application about a frame a worker skipped */
+static void
+gst_jpegtran_post_qos (Gstjpegtran * self, GstJpegTranJob * job)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (self);
+  GstClockTime stream_time;
+  GstClockTimeDiff jitter;
+  guint64 processed, dropped;
+  gdouble proportion;
+  GstMessage *msg;
+
+  stream_time = gst_segment_to_stream_time (&trans->segment, GST_FORMAT_TIME,
+      job->pts);
+
+  GST_OBJECT_LOCK (self);
+  processed = self->qos_processed;
+  dropped = ++self->qos_dropped;
+  proportion = self->proportion;
+  jitter = GST_CLOCK_DIFF (job->running_time, self->earliest_time);
+  GST_OBJECT_UNLOCK (self);
+
+  GST_DEBUG_OBJECT (self, "skipped late frame %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (job->running_time));
+
+  msg = gst_message_new_qos (GST_OBJECT_CAST (self), FALSE,
+      job->running_time, stream_time, job->pts, job->duration);
+  gst_message_set_qos_values (msg, jitter, proportion, 1000000);
+  gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, processed, dropped);
+  gst_element_post_message (GST_ELEMENT_CAST (self), msg);
+}
+
+/* output queue
+ *
+ * generate_output() hands every output to the ring instead of the base
+ * class, and a task on the src pad pushes them, so a downstream element
+ * blocking in its chain function does not hold up the transforms. The
+ * streaming thread only waits when the ring is full, in frames or in
+ * bytes, and before serialized events and new caps until it is empty. */
+
+/* wake whoever sleeps on the ring after moving head or tail, the atomic
+ * ring_waiting saves the lock while nobody does */
+static void
+gst_jpegtran_ring_wake (Gstjpegtran * self)
+{
+  if (g_atomic_int_get (&self->ring_waiting) > 0) {
+    g_mutex_lock (&self->ring_lock);
+    g_cond_broadcast (&self->ring_cond);
+    g_mutex_unlock (&self->ring_lock);
+  }
+}
+
+static gboolean
+gst_jpegtran_ring_is_empty (Gstjpegtran * self)
+{
+  return g_atomic_int_get ((gint *) & self->ring_head) ==
+      g_atomic_int_get ((gint *) & self->ring_tail);
+}
+
+static gboolean
+gst_jpegtran_ring_is_full (Gstjpegtran * self)
+{
+  guint count = (guint) g_atomic_int_get ((gint *) & self->ring_tail) -
+      (guint) g_atomic_int_get ((gint *) & self->ring_head);
+
+  if (count >= self->ring_size)
+    return TRUE;
+  return count > 0 && self->queue_bytes > 0
+      && (gsize) g_atomic_pointer_get (&self->ring_bytes) >=
+      self->queue_bytes;
+}
+
+/* GST_FLOW_OK while the ring takes outputs */
+static GstFlowReturn
+gst_jpegtran_ring_flow (Gstjpegtran * self)
+{
+  if (g_atomic_int_get (&self->ring_flushing))
+    return GST_FLOW_FLUSHING;
+  return g_atomic_int_get (&self->ring_flow);
+}
+
+/* sleep until ready() holds or the ring stops, the condition is checked
+ * again after announcing the wait so a wake in between is not lost */
+static void
+gst_jpegtran_ring_wait (Gstjpegtran * self,
+    gboolean (*ready) (Gstjpegtran * self))
+{
+  g_mutex_lock (&self->ring_lock);
+  g_atomic_int_inc (&self->ring_waiting);
+  if (!ready (self) && gst_jpegtran_ring_flow (self) == GST_FLOW_OK)
+    g_cond_wait (&self->ring_cond, &self->ring_lock);
+  g_atomic_int_add (&self->ring_waiting, -1);
+  g_mutex_unlock (&self->ring_lock);
+}
+
+static gboolean
+gst_jpegtran_ring_has_room (Gstjpegtran * self)
+{
+  return !gst_jpegtran_ring_is_full (self);
+}
+
+static gboolean
+gst_jpegtran_ring_has_data (Gstjpegtran * self)
+{
+  return !gst_jpegtran_ring_is_empty (self);
+}
+
+/* the producer side, from the streaming thread */
+static GstFlowReturn
+gst_jpegtran_ring_push (Gstjpegtran * self, GstBuffer * buf)
+{
+  GstFlowReturn ret;
+  guint tail;
+
+  while ((ret = gst_jpegtran_ring_flow (self)) == GST_FLOW_OK
+      && gst_jpegtran_ring_is_full (self))
+    gst_jpegtran_ring_wait (self, gst_jpegtran_ring_has_room);
+  if (ret != GST_FLOW_OK) {
+    gst_buffer_unref (buf);
+    return ret;
+  }
+
+  tail = (guint) g_atomic_int_get ((gint *) & self->ring_tail);
+  self->ring[tail & self->ring_mask] = buf;
+  g_atomic_pointer_add (&self->ring_bytes, gst_buffer_get_size (buf));
+  g_atomic_int_set ((gint *) & self->ring_tail, (gint) (tail + 1));
+  gst_jpegtran_ring_wake (self);
+
+  return GST_FLOW_OK;
+}
+
+/* until everything queued so far is pushed */
+static GstFlowReturn
+gst_jpegtran_ring_drain (Gstjpegtran * self)
+{
+  GstFlowReturn ret;
+
+  if (self->ring == NULL)
+    return GST_FLOW_OK;
+
+  while ((ret = gst_jpegtran_ring_flow (self)) == GST_FLOW_OK
+      && !gst_jpegtran_ring_is_empty (self))
+    gst_jpegtran_ring_wait (self, gst_jpegtran_ring_is_empty);
+
+  return ret;
+}
+
+/* the consumer side drops what is left, only from the task or with the
+ * task stopped */
+static void
+gst_jpegtran_ring_clear (Gstjpegtran * self)
+{
+  guint head = (guint) g_atomic_int_get ((gint *) & self->ring_head);
+  guint tail = (guint) g_atomic_int_get ((gint *) & self->ring_tail);
+
+  for (; head != tail; head++) {
+    GstBuffer **slot = &self->ring[head & self->ring_mask];
+
+    g_atomic_pointer_add (&self->ring_bytes, -(gssize)
+        gst_buffer_get_size (*slot));
+    gst_buffer_unref (*slot);
+    *slot = NULL;
+  }
+  g_atomic_int_set ((gint *) & self->ring_head, (gint) head);
+}
+
+static void
+gst_jpegtran_ring_loop (gpointer user_data)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (user_data);
+  GstPad *srcpad = GST_BASE_TRANSFORM_SRC_PAD (self);
+  GstFlowReturn ret;
+  GstBuffer *buf;
+  guint head;
+  gsize size;
+
+  if (gst_jpegtran_ring_is_empty (self)) {
+    gst_jpegtran_ring_wait (self, gst_jpegtran_ring_has_data);
+    if (gst_jpegtran_ring_flow (self) != GST_FLOW_OK)
+      gst_pad_pause_task (srcpad);
+    return;
+  }
+
+  head = (guint) g_atomic_int_get ((gint *) & self->ring_head);
+  buf = self->ring[head & self->ring_mask];
+  self->ring[head & self->ring_mask] = NULL;
+  size = gst_buffer_get_size (buf);
+
+  ret = gst_pad_push (srcpad, buf);
+
+  /* only now, a drain waits for this push as well */
+  g_atomic_pointer_add (&self->ring_bytes, -(gssize) size);
+  g_atomic_int_set ((gint *) & self->ring_head, (gint) (head + 1));
+
+  if (ret != GST_FLOW_OK) {
+    GST_DEBUG_OBJECT (self, "pausing output queue, %s",
+        gst_flow_get_name (ret));
+    /* the streaming thread returns it for the next output */
+    g_atomic_int_set (&self->ring_flow, ret);
+    gst_jpegtran_ring_clear (self);
+    gst_pad_pause_task (srcpad);
+  }
+  gst_jpegtran_ring_wake (self);
+}
+
+static void
+gst_jpegtran_ring_start (Gstjpegtran * self)
+{
+  g_atomic_int_set (&self->ring_flow, GST_FLOW_OK);
+  g_atomic_int_set (&self->ring_flushing, FALSE);
+  gst_pad_start_task (GST_BASE_TRANSFORM_SRC_PAD (self),
+      gst_jpegtran_ring_loop, self, NULL);
+}
+
+/* wakes both sides, the task then pauses itself */
+static void
+gst_jpegtran_ring_set_flushing (Gstjpegtran * self)
+{
+  g_atomic_int_set (&self->ring_flushing, TRUE);
+  g_mutex_lock (&self->ring_lock);
+  g_cond_broadcast (&self->ring_cond);
+  g_mutex_unlock (&self->ring_lock);
+}
+
+static void
+gst_jpegtran_ring_free (Gstjpegtran * self)
+{
+  if (self->ring == NULL)
+    return;
+
+  gst_jpegtran_ring_set_flushing (self);
+  gst_pad_stop_task (GST_BASE_TRANSFORM_SRC_PAD (self));
+  gst_jpegtran_ring_clear (self);
+  g_free (self->ring);
+  self->ring = NULL;
+  self->ring_size = 0;
+  self->ring_mask = 0;
+}
+
+/* the first output after dropped frames is marked, whether the base
+ * class, a worker, the framer or a buffer list dropped them. The base
+ * class only knows about its own drops and only when it pushes */
+static GstBuffer *
+gst_jpegtran_mark_discont (Gstjpegtran * self, GstBuffer * buf)
+{
+  if (self->qos_discont) {
+    buf = gst_buffer_make_writable (buf);
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+    self->qos_discont = FALSE;
+  }
+
+  return buf;
+}
+
+/* outputs that do not go through the base class */
+static GstFlowReturn
+gst_jpegtran_push_output (Gstjpegtran * self, GstBuffer * buf)
+{
+  buf = gst_jpegtran_mark_discont (self, buf);
+  if (self->ring != NULL)
+    return gst_jpegtran_ring_push (self, buf);
+
+  return gst_pad_push (GST_BASE_TRANSFORM_SRC_PAD (self), buf);
+}
+
+static gboolean
+gst_jpegtran_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (parent);
+  gboolean ret;
+
+  if (!active && self->ring != NULL) {
+    gst_jpegtran_ring_set_flushing (self);
+    gst_pad_stop_task (pad);
+  }
+
+  ret = self->src_activate_mode (pad, parent, mode, active);
+
+  /* start() made the ring, on this or the sink pad */
+  if (ret && active && mode == GST_PAD_MODE_PUSH && self->ring != NULL)
+    gst_jpegtran_ring_start (self);
+
+  return ret;
+}
+
+/* frame-parallel mode
+ *
+ * submit_input_buffer() prepares the output buffer on the streaming
+ * thread and queues the frame as a task of this stream's client on the
+ * workers shared by all instances. generate_output() hands finished
+ * frames back to the base class strictly in input order. */
+
+static void
+gst_jpegtran_run_job (GstJpegTranTask * task, tjhandle handle,
+    gpointer user_data)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (user_data);
+  GstJpegTranJob *job = (GstJpegTranJob *) task;
+
+  /* QoS was checked when the frame came in, but it may have waited
+   * here for long enough to be late after all */
+  if (gst_jpegtran_is_late (self, job->running_time)) {
+    job->ret = GST_BASE_TRANSFORM_FLOW_DROPPED;
+  } else if (handle != NULL) {
+    job->ret = gst_jpegtran_do_transform (self, handle, job->inbuf,
+        job->outbuf, &job->config, job->extra, job->n_extra);
+  } else {
+    GST_ELEMENT_ERROR (self, LIBRARY, INIT, ("cannot init transform"),
+        ("%s", tjGetErrorStr2 (NULL)));
+    job->ret = GST_FLOW_ERROR;
+  }
+  gst_buffer_unref (job->inbuf);
+  job->inbuf = NULL;
+
+  g_mutex_lock (&self->lock);
+  job->done = TRUE;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gst_jpegtran_start_workers (Gstjpegtran * self, guint n_threads)
+{
+  GST_DEBUG_OBJECT (self, "up to %u frames on the shared workers",
+      n_threads);
+
+  self->client = gst_jpegtran_client_new (n_threads);
+  self->n_workers = n_threads;
+}
+
+static void
+gst_jpegtran_stop_workers (Gstjpegtran * self)
+{
+  if (self->client == NULL)
+    return;
+
+  gst_jpegtran_client_free (self->client);
+  self->client = NULL;
+  self->n_workers = 0;
+}
+
+static void
+gst_jpegtran_job_free (GstJpegTranJob * job)
+{
+  if (job->inbuf)
+    gst_buffer_unref (job->inbuf);
+  if (job->outbuf)
+    gst_buffer_unref (job->outbuf);
+  if (job->extra)
+    gst_jpegtran_free_extra_outputs (job->extra, job->n_extra);
+  if (job->config.ops)
+    g_array_unref (job->config.ops);
+  g_free (job);
+}
+
+/* wait for all frames in flight, push them downstream or drop them */
+static GstFlowReturn
+gst_jpegtran_drain (Gstjpegtran * self, gboolean push)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (self);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstJpegTranJob *job;
+
+  g_mutex_lock (&self->lock);
+  while ((job = g_queue_pop_head (&self->pending)) != NULL) {
+    while (!job->done)
+      g_cond_wait (&self->cond, &self->lock);
+    g_mutex_unlock (&self->lock);
+
+    if (job->ret == GST_BASE_TRANSFORM_FLOW_DROPPED) {
+      if (push) {
+        gst_jpegtran_post_qos (self, job);
+        self->qos_discont = TRUE;
+      }
+    } else if (push && ret == GST_FLOW_OK && job->ret == GST_FLOW_OK) {
+      ret = gst_jpegtran_push_extra_outputs (self, job->extra, job->n_extra);
+      if (ret == GST_FLOW_OK)
+        ret = gst_jpegtran_push_output (self, job->outbuf);
+      job->outbuf = NULL;
+    } else if (ret == GST_FLOW_OK) {
+      ret = job->ret;
+    }
+    gst_jpegtran_job_free (job);
+
+    g_mutex_lock (&self->lock);
+  }
+  g_mutex_unlock (&self->lock);
+
+  if (ret != GST_FLOW_OK)
+    GST_DEBUG_OBJECT (self, "drain returned %s", gst_flow_get_name (ret));
+
+  return ret;
+}
+
+static gboolean
+gst_jpegtran_src_event (GstBaseTransform * trans, GstEvent * event)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+
+  if (gst_jpegtran_handle_crop_event (G_OBJECT (trans), event)) {
+    gst_event_unref (event);
+    return TRUE;
+  }
+
+  /* the base class keeps its own copy for the frames coming in */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_QOS) {
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+    gdouble proportion;
+
+    gst_event_parse_qos (event, NULL, &proportion, &diff, &timestamp);
+    GST_OBJECT_LOCK (self);
+    self->proportion = proportion;
+    self->earliest_time = timestamp + diff;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  return GST_BASE_TRANSFORM_CLASS (parent_class)->src_event (trans, event);
+}
+
+static gboolean
+gst_jpegtran_sink_event (GstBaseTransform * trans, GstEvent * event)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstEventType type = GST_EVENT_TYPE (event);
+  GList *extra_pads, *l;
+  gboolean ret;
+
+  /* the frames in flight have their transform already */
+  if (gst_jpegtran_handle_xop_event (G_OBJECT (self), event)) {
+    gst_event_unref (event);
+    return TRUE;
+  }
+
+  /* serialized events must not overtake the frames still in flight */
+  if (self->n_workers > 0) {
+    if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP)
+      gst_jpegtran_drain (self, FALSE);
+    else if (GST_EVENT_IS_SERIALIZED (event))
+      gst_jpegtran_drain (self, TRUE);
+  }
+
+  /* nor the ones in the output queue, a flush unblocks both of its
+   * sides */
+  if (self->ring != NULL) {
+    if (type == GST_EVENT_FLUSH_START)
+      gst_jpegtran_ring_set_flushing (self);
+    else if (type != GST_EVENT_FLUSH_STOP && GST_EVENT_IS_SERIALIZED (event))
+      gst_jpegtran_ring_drain (self);
+  }
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_STREAM_START) {
+    GST_OBJECT_LOCK (self);
+    self->tag_xop = TJXOP_NONE;
+    gst_clear_tag_list (&self->orientation_tags);
+    GST_OBJECT_UNLOCK (self);
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+    GST_OBJECT_LOCK (self);
+    self->earliest_time = GST_CLOCK_TIME_NONE;
+    self->proportion = 1.0;
+    GST_OBJECT_UNLOCK (self);
+    gst_jpegtran_reset_framing (self);
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_EOS) {
+    if (self->framing && gst_jpeg_framer_in_image (&self->framer))
+      GST_WARNING_OBJECT (self, "dropping the incomplete image at EOS");
+    gst_jpegtran_reset_framing (self);
+  } else if (GST_EVENT_TYPE (event) == GST_EVENT_TAG) {
+    event = gst_jpegtran_handle_orientation_tag (self, event);
+  }
+
+  /* the request pads carry the same stream */
+  GST_OBJECT_LOCK (self);
+  extra_pads = g_list_copy_deep (self->extra_pads, (GCopyFunc) gst_object_ref,
+      NULL);
+  GST_OBJECT_UNLOCK (self);
+  for (l = extra_pads; l != NULL; l = l->next) {
+    GstJpegTranPad *pad = l->data;
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      GstCaps *caps;
+
+      gst_event_parse_caps (event, &caps);
+      gst_jpegtran_pad_push_caps (pad, caps);
+    } else {
+      gst_pad_push_event (GST_PAD (pad), gst_event_ref (event));
+    }
+  }
+  g_list_free_full (extra_pads, gst_object_unref);
+
+  ret = GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
+
+  /* downstream is flushing by now, a push in the task returns */
+  if (self->ring != NULL) {
+    if (type == GST_EVENT_FLUSH_START) {
+      gst_pad_pause_task (trans->srcpad);
+    } else if (type == GST_EVENT_FLUSH_STOP) {
+      gst_pad_pause_task (trans->srcpad);
+      gst_jpegtran_ring_clear (self);
+      gst_jpegtran_ring_start (self);
+    }
+  }
+
+  return ret;
+}
+
+/* starts with SOI and ends with EOI, read without merging the memories */
+static gboolean
+gst_jpegtran_is_whole_image (GstBuffer * buf)
+{
+  gsize size = gst_buffer_get_size (buf);
+  guint8 soi[2], eoi[2];
+
+  return size >= 4 && gst_buffer_extract (buf, 0, soi, 2) == 2
+      && gst_buffer_extract (buf, size - 2, eoi, 2) == 2
+      && soi[0] == 0xFF && soi[1] == JPEG_MARKER_SOI
+      && eoi[0] == 0xFF && eoi[1] == JPEG_MARKER_EOI;
+}
+
+/* forget the bytes and images of the stream so far */
+static void
+gst_jpegtran_reset_framing (Gstjpegtran * self)
+{
+  GstBuffer *frame;
+
+  gst_adapter_clear (self->adapter);
+  gst_jpeg_framer_reset (&self->framer);
+  self->framer_offset = self->adapter_offset = self->image_start = 0;
+  self->image_pts = self->last_pts = GST_CLOCK_TIME_NONE;
+  self->frame_discont = TRUE;
+  while ((frame = g_queue_pop_head (&self->frames)) != NULL)
+    gst_buffer_unref (frame);
+}
+
+/* cut the image ending at stream offset end out of the adapter, a
+ * sub-buffer when it lies in one input buffer */
+static void
+gst_jpegtran_take_frame (Gstjpegtran * self, guint64 end)
+{
+  GstBuffer *frame;
+
+  gst_adapter_flush (self->adapter, self->image_start - self->adapter_offset);
+  frame = gst_adapter_take_buffer (self->adapter, end - self->image_start);
+  self->adapter_offset = end;
+
+  frame = gst_buffer_make_writable (frame);
+  GST_BUFFER_PTS (frame) = self->image_pts;
+  GST_BUFFER_DTS (frame) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DURATION (frame) = self->frame_duration;
+  if (self->frame_discont)
+    GST_BUFFER_FLAG_SET (frame, GST_BUFFER_FLAG_DISCONT);
+  else
+    GST_BUFFER_FLAG_UNSET (frame, GST_BUFFER_FLAG_DISCONT);
+  self->frame_discont = FALSE;
+  self->last_pts = self->image_pts;
+
+  GST_LOG_OBJECT (self, "image of %" G_GSIZE_FORMAT " bytes at %"
+      GST_TIME_FORMAT, gst_buffer_get_size (frame),
+      GST_TIME_ARGS (self->image_pts));
+  g_queue_push_tail (&self->frames, frame);
+}
+
+/* queue the images that input completes in frames. Each image takes
+ * the timestamp of the buffer its SOI is in, unless an earlier image
+ * took it already, then it follows the previous one by the framerate */
+static void
+gst_jpegtran_frame_input (Gstjpegtran * self, gboolean is_discont,
+    GstBuffer * input)
+{
+  GstClockTime pts = GST_BUFFER_PTS (input);
+  guint i, n_memory = gst_buffer_n_memory (input);
+
+  /* whatever was cut short is lost */
+  if (is_discont && self->framer_offset > 0) {
+    GST_DEBUG_OBJECT (self, "discont, restarting the framing");
+    gst_adapter_clear (self->adapter);
+    gst_jpeg_framer_reset (&self->framer);
+    self->adapter_offset = self->framer_offset;
+    self->frame_discont = TRUE;
+  }
+
+  gst_adapter_push (self->adapter, gst_buffer_ref (input));
+
+  /* scan the memories one by one rather than merging them */
+  for (i = 0; i < n_memory; i++) {
+    GstMemory *mem = gst_buffer_peek_memory (input, i);
+    GstMapInfo map;
+    gsize offset = 0;
+
+    if (!gst_memory_map (mem, &map, GST_MAP_READ)) {
+      GST_WARNING_OBJECT (self, "cannot map input memory");
+      gst_jpeg_framer_reset (&self->framer);
+      self->framer_offset += gst_memory_get_sizes (mem, NULL, NULL);
+      continue;
+    }
+
+    while (offset < map.size) {
+      GstJpegFramerEvent event;
+      guint64 pos;
+
+      offset += gst_jpeg_framer_scan (&self->framer, map.data + offset,
+          map.size - offset, &event);
+      pos = self->framer_offset + offset;
+
+      if (event == GST_JPEG_FRAMER_SOI) {
+        self->image_start = pos - 2;
+        if (GST_CLOCK_TIME_IS_VALID (pts)) {
+          self->image_pts = pts;
+          pts = GST_CLOCK_TIME_NONE;
+        } else if (GST_CLOCK_TIME_IS_VALID (self->last_pts)
+            && GST_CLOCK_TIME_IS_VALID (self->frame_duration)) {
+          self->image_pts = self->last_pts + self->frame_duration;
+        } else {
+          self->image_pts = GST_CLOCK_TIME_NONE;
+        }
+      } else if (event == GST_JPEG_FRAMER_EOI) {
+        gst_jpegtran_take_frame (self, pos);
+      }
+    }
+
+    self->framer_offset += map.size;
+    gst_memory_unmap (mem, &map);
+  }
+
+  /* drop the bytes between images, but the last one could start the
+   * next SOI */
+  if (!gst_jpeg_framer_in_image (&self->framer)
+      && self->framer_offset > self->adapter_offset + 1) {
+    gst_adapter_flush (self->adapter,
+        self->framer_offset - 1 - self->adapter_offset);
+    self->adapter_offset = self->framer_offset - 1;
+  }
+
+  gst_buffer_unref (input);
+}
+
+/* the first frame that a GstJpegTranMeta has auto-rotated, the
+ * orientation tag that went out before it is not true any longer */
+static void
+gst_jpegtran_meta_auto (Gstjpegtran * self)
+{
+  GstTagList *taglist;
+
+  GST_OBJECT_LOCK (self);
+  self->meta_auto = TRUE;
+  taglist = self->orientation_tags;
+  self->orientation_tags = NULL;
+  GST_OBJECT_UNLOCK (self);
+
+  if (taglist == NULL)
+    return;
+
+  /* after the frames that were not rotated */
+  if (gst_jpegtran_drain (self, TRUE) == GST_FLOW_OK
+      && gst_jpegtran_ring_drain (self) == GST_FLOW_OK)
+    gst_pad_push_event (GST_BASE_TRANSFORM_SRC_PAD (self),
+        gst_jpegtran_upright_tag_event (taglist));
+  gst_tag_list_unref (taglist);
+}
+
+/* hands one image to the base class, or to a worker */
+static GstFlowReturn
+gst_jpegtran_submit_frame (Gstjpegtran * self, gboolean is_discont,
+    GstBuffer * input)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (self);
+  GstJpegTranJob *job;
+  GstJpegTranSplice splice;
+  GstBuffer *inbuf;
+  GstJpegTranXop meta_xop;
+  GstFlowReturn ret;
+
+  /* frames with a transform of their own can not be passed through, and
+   * their caps leave the geometry open */
+  if (gst_jpegtran_buffer_get_xop (input, &meta_xop)) {
+    gboolean first;
+
+    GST_OBJECT_LOCK (self);
+    first = !self->per_buffer_xop;
+    self->per_buffer_xop = TRUE;
+    GST_OBJECT_UNLOCK (self);
+
+    if (first) {
+      GST_DEBUG_OBJECT (self, "buffers carry their xop");
+      gst_jpegtran_update_passthrough (self);
+      gst_base_transform_reconfigure_src (trans);
+    }
+    if (meta_xop == GST_JPEGTRAN_XOP_AUTO && !self->meta_auto)
+      gst_jpegtran_meta_auto (self);
+  }
+
+  /* tjTransform() needs the frame in one piece, so a fragmented frame is
+   * still merged, but at most once: mapping a buffer of several memories
+   * merges them and only a writable buffer keeps the result. Making a
+   * shared input writable copies its metadata too, for every fragmented
+   * frame */
+  if (gst_buffer_n_memory (input) > 1
+      && !gst_base_transform_is_passthrough (trans))
+    input = gst_buffer_make_writable (input);
+
+  /* new caps must not overtake the frames still in flight or queued */
+  if ((self->n_workers > 0 || self->ring != NULL)
+      && gst_pad_needs_reconfigure (trans->srcpad)) {
+    ret = gst_jpegtran_drain (self, TRUE);
+    if (ret == GST_FLOW_OK)
+      ret = gst_jpegtran_ring_drain (self);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (input);
+      return ret;
+    }
+  }
+
+  /* negotiation and QoS, leaves the buffer in queued_buf */
+  ret = GST_BASE_TRANSFORM_CLASS (parent_class)->submit_input_buffer (trans,
+      is_discont, input);
+  if (ret == GST_BASE_TRANSFORM_FLOW_DROPPED) {
+    GST_OBJECT_LOCK (self);
+    self->qos_dropped++;
+    GST_OBJECT_UNLOCK (self);
+    /* the base class only marks the next output it pushes itself,
+     * not those of a list or of the output queue */
+    self->qos_discont = TRUE;
+  }
+  if (ret != GST_FLOW_OK || self->n_workers == 0)
+    return ret;
+
+  inbuf = trans->queued_buf;
+  trans->queued_buf = NULL;
+
+  job = g_new0 (GstJpegTranJob, 1);
+  job->ret = GST_FLOW_OK;
+  job->pts = GST_BUFFER_PTS (inbuf);
+  job->duration = GST_BUFFER_DURATION (inbuf);
+  job->running_time = trans->segment.format == GST_FORMAT_TIME ?
+      gst_segment_to_running_time (&trans->segment, GST_FORMAT_TIME,
+      job->pts) : GST_CLOCK_TIME_NONE;
+
+  if (gst_base_transform_is_passthrough (trans)) {
+    job->outbuf = inbuf;
+    job->done = TRUE;
+  } else if (gst_jpegtran_get_splice (self, inbuf, &splice)
+      && (job->ret = gst_jpegtran_splice (self, inbuf, &splice,
+              &job->outbuf)) != GST_FLOW_CUSTOM_SUCCESS) {
+    /* only touches the header, not worth a worker */
+    gst_buffer_unref (inbuf);
+    job->done = TRUE;
+  } else {
+    job->ret = GST_FLOW_OK;
+    ret = GST_BASE_TRANSFORM_GET_CLASS (trans)->prepare_output_buffer (trans,
+        inbuf, &job->outbuf);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (inbuf);
+      g_free (job);
+      return ret;
+    }
+    job->inbuf = inbuf;
+    gst_jpegtran_get_xform (self, inbuf, &job->config.xform,
+        &job->config.ops);
+    job->extra = gst_jpegtran_get_extra_outputs (self, &job->n_extra);
+  }
+
+  g_mutex_lock (&self->lock);
+  g_queue_push_tail (&self->pending, job);
+  g_mutex_unlock (&self->lock);
+
+  if (!job->done) {
+    job->task.func = gst_jpegtran_run_job;
+    job->task.user_data = self;
+    gst_jpegtran_client_push (self->client, &job->task);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_jpegtran_submit_input_buffer (GstBaseTransform * trans,
+    gboolean is_discont, GstBuffer * input)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBuffer *frame;
+
+  if (!self->framing && self->may_frame
+      && !gst_jpegtran_is_whole_image (input)) {
+    GST_DEBUG_OBJECT (self, "buffer is not a whole image, framing the "
+        "stream from now on");
+    gst_jpegtran_reset_framing (self);
+    self->framing = TRUE;
+  }
+  if (!self->framing)
+    return gst_jpegtran_submit_frame (self, is_discont, input);
+
+  gst_jpegtran_frame_input (self, is_discont, input);
+
+  /* without workers generate_output takes them one at a time */
+  if (self->n_workers == 0)
+    return GST_FLOW_OK;
+
+  while ((ret == GST_FLOW_OK || ret == GST_BASE_TRANSFORM_FLOW_DROPPED)
+      && (frame = g_queue_pop_head (&self->frames)) != NULL)
+    ret = gst_jpegtran_submit_frame (self, GST_BUFFER_IS_DISCONT (frame),
+        frame);
+
+  return ret == GST_BASE_TRANSFORM_FLOW_DROPPED ? GST_FLOW_OK : ret;
+}
+
+static GstFlowReturn
+gst_jpegtran_generate (Gstjpegtran * self, GstBuffer ** outbuf)
+{
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (self);
+  GstJpegTranJob *job;
+  GstFlowReturn ret;
+
+  if (self->n_workers == 0) {
+    GstJpegTranSplice splice;
+    GstBuffer *frame;
+
+    /* the next image cut out of the stream */
+    while (self->framing && trans->queued_buf == NULL
+        && (frame = g_queue_pop_head (&self->frames)) != NULL) {
+      ret = gst_jpegtran_submit_frame (self, GST_BUFFER_IS_DISCONT (frame),
+          frame);
+      if (ret != GST_FLOW_OK && ret != GST_BASE_TRANSFORM_FLOW_DROPPED) {
+        *outbuf = NULL;
+        return ret;
+      }
+    }
+
+    if (trans->queued_buf != NULL && !gst_base_transform_is_passthrough (trans)
+        && gst_jpegtran_get_splice (self, trans->queued_buf, &splice)) {
+      *outbuf = NULL;
+      ret = gst_jpegtran_splice (self, trans->queued_buf, &splice, outbuf);
+      if (ret != GST_FLOW_CUSTOM_SUCCESS) {
+        gst_buffer_replace (&trans->queued_buf, NULL);
+        return ret;
+      }
+    }
+
+    return GST_BASE_TRANSFORM_CLASS (parent_class)->generate_output (trans,
+        outbuf);
+  }
+
+  *outbuf = NULL;
+
+  g_mutex_lock (&self->lock);
+  for (;;) {
+    /* only block when too many frames are in flight */
+    job = g_queue_peek_head (&self->pending);
+    while (job != NULL && !job->done
+        && self->pending.length >= self->n_workers * JOBS_PER_WORKER)
+      g_cond_wait (&self->cond, &self->lock);
+
+    if (job == NULL || !job->done) {
+      g_mutex_unlock (&self->lock);
+      return GST_FLOW_OK;
+    }
+    g_queue_pop_head (&self->pending);
+    if (job->ret != GST_BASE_TRANSFORM_FLOW_DROPPED)
+      break;
+
+    g_mutex_unlock (&self->lock);
+    gst_jpegtran_post_qos (self, job);
+    gst_jpegtran_job_free (job);
+    self->qos_discont = TRUE;
+    g_mutex_lock (&self->lock);
+  }
+  g_mutex_unlock (&self->lock);
+
+  ret = job->ret;
+  if (ret == GST_FLOW_OK)
+    ret = gst_jpegtran_push_extra_outputs (self, job->extra, job->n_extra);
+  if (ret == GST_FLOW_OK) {
+    *outbuf = job->outbuf;
+    job->outbuf = NULL;
+    GST_OBJECT_LOCK (self);
+    self->qos_processed++;
+    GST_OBJECT_UNLOCK (self);
+  }
+  gst_jpegtran_job_free (job);
+
+  return ret;
+}
+
+static GstFlowReturn
+gst_jpegtran_generate_output (GstBaseTransform * trans, GstBuffer ** outbuf)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (trans);
+  GstFlowReturn ret;
+  GstBuffer *buf;
+
+  if (self->ring == NULL) {
+    ret = gst_jpegtran_generate (self, outbuf);
+    if (ret == GST_FLOW_OK && *outbuf != NULL)
+      *outbuf = gst_jpegtran_mark_discont (self, *outbuf);
+    return ret;
+  }
+
+  /* everything goes to the output queue, the base class pushes nothing */
+  *outbuf = NULL;
+  do {
+    buf = NULL;
+    ret = gst_jpegtran_generate (self, &buf);
+    if (buf == NULL)
+      break;
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (buf);
+      break;
+    }
+    ret = gst_jpegtran_push_output (self, buf);
+  } while (ret == GST_FLOW_OK);
+
+  return ret;
+}
+
+/* pushes the outputs gathered so far and starts a new list */
+static GstFlowReturn
+gst_jpegtran_push_list (Gstjpegtran * self, GstBufferList ** outlist)
+{
+  GstBufferList *list = *outlist;
+
+  if (gst_buffer_list_length (list) == 0)
+    return GST_FLOW_OK;
+
+  *outlist = gst_buffer_list_new ();
+  GST_LOG_OBJECT (self, "pushing %u buffers", gst_buffer_list_length (list));
+
+  return gst_pad_push_list (GST_BASE_TRANSFORM_SRC_PAD (self), list);
+}
+
+/* GstBaseTransform has no chain_list, it would chain the buffers of a
+ * list one by one and push every output on its own. This runs them
+ * through the same submit_input_buffer() and generate_output() the base
+ * class uses, under the same lock, with one borrowed handle for the whole
+ * list, and pushes the outputs as one list. With QoS the base class
+ * counts processed and dropped buffers for its QoS messages in its own
+ * chain, so the list goes through that one buffer at a time instead. */
+static GstFlowReturn
+gst_jpegtran_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  Gstjpegtran *self = GST_JPEGTRAN (parent);
+  GstBaseTransform *trans = GST_BASE_TRANSFORM (parent);
+  GstBaseTransformClass *klass = GST_BASE_TRANSFORM_GET_CLASS (trans);
+  GstFlowReturn ret = GST_FLOW_OK, push_ret;
+  GstBufferList *outlist;
+  GstPadChainFunction chain;
+  guint i, len;
+
+  len = gst_buffer_list_length (list);
+  if (gst_base_transform_is_qos_enabled (trans)) {
+    chain = GST_PAD_CHAINFUNC (pad);
+    for (i = 0; i < len && ret == GST_FLOW_OK; i++)
+      ret = chain (pad, parent, gst_buffer_ref (gst_buffer_list_get (list,
+                  i)));
+    gst_buffer_list_unref (list);
+    return ret;
+  }
+
+  outlist = gst_buffer_list_new_sized (len);
+  if (self->n_workers == 0)
+    self->list_handle = gst_jpegtran_pool_get_handle ();
+
+  for (i = 0; i < len && ret == GST_FLOW_OK; i++) {
+    GstBuffer *inbuf = gst_buffer_ref (gst_buffer_list_get (list, i));
+    GstBuffer *outbuf;
+    GstClockTime position;
+
+    /* draining for new caps pushes on its own, the outputs before it
+     * must go first */
+    if (self->n_workers > 0 && gst_pad_needs_reconfigure (trans->srcpad))
+      ret = gst_jpegtran_push_list (self, &outlist);
+    if (ret != GST_FLOW_OK) {
+      gst_buffer_unref (inbuf);
+      break;
+    }
+
+    if (klass->before_transform)
+      klass->before_transform (trans, inbuf);
+
+    /* what the base class passes: a DISCONT input or a drop before */
+    if (GST_BUFFER_IS_DISCONT (inbuf))
+      self->qos_discont = TRUE;
+    GST_BASE_TRANSFORM_LOCK (trans);
+    ret = klass->submit_input_buffer (trans, self->qos_discont, inbuf);
+    GST_BASE_TRANSFORM_UNLOCK (trans);
+    while (ret == GST_FLOW_OK) {
+      outbuf = NULL;
+      GST_BASE_TRANSFORM_LOCK (trans);
+      ret = klass->generate_output (trans, &outbuf);
+      GST_BASE_TRANSFORM_UNLOCK (trans);
+      if (outbuf == NULL)
+        break;
+      if (ret != GST_FLOW_OK) {
+        gst_buffer_unref (outbuf);
+        break;
+      }
+
+      /* like the base class, the position follows the outputs */
+      position = GST_BUFFER_PTS (outbuf);
+      if (GST_CLOCK_TIME_IS_VALID (position)) {
+        if (GST_BUFFER_DURATION_IS_VALID (outbuf))
+          position += GST_BUFFER_DURATION (outbuf);
+        GST_OBJECT_LOCK (self);
+        if (trans->segment.format == GST_FORMAT_TIME)
+          trans->segment.position = position;
+        GST_OBJECT_UNLOCK (self);
+      }
+      gst_buffer_list_add (outlist, outbuf);
+    }
+
+    /* submit_input_buffer() flagged the next output as DISCONT, that may
+     * be in a later list */
+    if (ret == GST_BASE_TRANSFORM_FLOW_DROPPED)
+      ret = GST_FLOW_OK;
+  }
+
+  if (self->list_handle) {
+    gst_jpegtran_pool_put_handle (self->list_handle);
+    self->list_handle = NULL;
+  }
+  gst_buffer_list_unref (list);
+
+  /* what was transformed before an error still goes out */
+  push_ret = gst_jpegtran_push_list (self, &outlist);
+  gst_buffer_list_unref (outlist);
+  if (ret == GST_FLOW_OK)
+    ret = push_ret;
+
+  return ret;
+}
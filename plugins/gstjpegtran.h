@@ -48,29 +48,166 @@
 #define __GST_JPEGTRAN_H__
 
 #include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/base/gstadapter.h>
 #include <turbojpeg.h>
 
+#include "gstjpegmarkers.h"
+#include "gstjpegtranpool.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_JPEGTRAN (gst_jpegtran_get_type())
 G_DECLARE_FINAL_TYPE (Gstjpegtran, gst_jpegtran,
-    GST, JPEGTRAN, GstElement)
+    GST, JPEGTRAN, GstBaseTransform)
 
 typedef enum TJXOP GstJpegTranXop;
 
-struct _Gstjpegtran
+/* 8 buckets per octave of microseconds */
+#define GST_JPEGTRAN_STATS_SUB_BUCKETS 8
+#define GST_JPEGTRAN_STATS_BUCKETS (GST_JPEGTRAN_STATS_SUB_BUCKETS * 32)
+
+/* picks the xop of each frame from its orientation */
+#define GST_JPEGTRAN_XOP_AUTO ((GstJpegTranXop) TJ_NUMXOP)
+
+typedef enum
+{
+  GST_JPEGTRAN_COPY_MARKERS_ALL,
+  GST_JPEGTRAN_COPY_MARKERS_NONE,
+  GST_JPEGTRAN_COPY_MARKERS_ICC,
+  GST_JPEGTRAN_COPY_MARKERS_CUSTOM
+} GstJpegTranCopyMarkers;
+
+#define GST_TYPE_JPEGTRAN_PAD (gst_jpegtran_pad_get_type())
+G_DECLARE_FINAL_TYPE (GstJpegTranPad, gst_jpegtran_pad,
+    GST, JPEGTRAN_PAD, GstPad)
+
+/* request src pad with a transform of its own */
+struct _GstJpegTranPad
 {
-  GstElement element;
+  GstPad pad;
+
+  GstJpegTranXop xop;
+  tjregion crop;
+  gboolean gray;
+  /* the caps of this pad need to follow a property change */
+  gboolean caps_changed;
 
-  GstPad *sinkpad, *srcpad;
+  /* output buffers of this pad, pool_from_peer when downstream gave it */
+  GstBufferPool *pool;
+  gsize pool_size;
+  gboolean pool_from_peer;
+};
+
+struct _Gstjpegtran
+{
+  GstBaseTransform element;
 
   GstJpegTranXop xop;
-  tjhandle tjHandle;
-  tjhandle tjInstance;
+  GstJpegTranXop tag_xop;
+  /* the last tags with an orientation that went out unchanged, rewritten
+   * once a GstJpegTranMeta asks for auto, meta_auto */
+  GstTagList *orientation_tags;
+  gboolean meta_auto;
+  /* buffers carry a GstJpegTranMeta, no passthrough from then on */
+  gboolean per_buffer_xop;
+  tjregion crop;
+  gboolean gray;
+  gboolean progressive;
+  gboolean optimize;
+  gboolean virtual_rotation;
+  /* GstJpegTranOp, replace xop and crop when not empty */
+  GArray *ops;
+  gchar *ops_string;
+  GstJpegTranCopyMarkers copy_markers;
+  gchar *marker_list;
+  guint32 marker_mask;
+
+  /* output buffer size of the negotiated pool */
+  gsize pool_size;
+  gint width, height, subsamp;
+
+  /* SOF segment of the last frame, frames with the same one at the same
+   * offset share its geometry */
+  guint8 sof[2 + 2 + 6 + 3 * JPEG_MAX_COMPONENTS];
+  gsize sof_offset, sof_size;
+  gint sof_width, sof_height, sof_subsamp;
+
+  /* output size prediction */
+  gsize max_insize;
+  gdouble ratio;
+  guint64 predict_hits, predict_misses;
+
+  /* cost of progressive and optimized entropy coding */
+  gint64 bytes_saved;
+  GstClockTime coding_time;
+
+  /* transformed frames since start, transform times in a log scale
+   * histogram of microseconds */
+  guint64 stats_frames, stats_errors;
+  guint64 stats_bytes_in, stats_bytes_out, stats_alloc_bytes;
+  GstClockTime stats_time_max;
+  guint32 stats_hist[GST_JPEGTRAN_STATS_BUCKETS];
+  GstClockTime stats_interval, stats_last_post;
+
+  /* QoS of the src pad, for frames waiting for a worker */
+  GstClockTime earliest_time;
+  gdouble proportion;
+  guint64 qos_processed, qos_dropped;
+  /* the next output follows a skipped frame */
+  gboolean qos_discont;
+
+  /* images cut out of parsed=false input, offsets count stream bytes.
+   * Without parsed in the caps framing starts with the first buffer that
+   * is not a whole image, may_frame */
+  gboolean framing, may_frame;
+  GstAdapter *adapter;
+  GstJpegFramer framer;
+  guint64 framer_offset, adapter_offset, image_start;
+  GstClockTime image_pts, last_pts, frame_duration;
+  gboolean frame_discont;
+  GQueue frames;
+
+  /* frame-parallel mode on the shared workers, n_workers frames at a
+   * time */
+  guint n_threads;
+  GstJpegTranClient *client;
+  guint n_workers;
+  GQueue pending;
+  /* borrowed for all frames of a buffer list on the streaming thread */
+  tjhandle list_handle;
+
+  /* outputs waiting for the task of the src pad, a ring with one
+   * producer and one consumer. head and tail only ever grow and wrap,
+   * the streaming thread moves tail and the task moves head, slot
+   * ring_mask & counter. ring_size frames at most fit in the
+   * ring_mask + 1 slots. The lock and cond are only for sleeping on a
+   * full or empty ring. */
+  guint queue_frames;
+  guint64 queue_bytes;
+  GstBuffer **ring;
+  guint ring_size, ring_mask;
+  guint ring_head, ring_tail;
+  gsize ring_bytes;
+  gint ring_waiting;
+  gint ring_flushing;
+  gint ring_flow;
+  GMutex ring_lock;
+  GCond ring_cond;
+  GstPadActivateModeFunction src_activate_mode;
+  GMutex lock;
+  GCond cond;
+
+  /* restart interval stripes of a single frame, on the shared stripe
+   * threads */
+  guint n_stripe_threads;
+  guint n_stripe_workers;
+
+  /* request src pads, GstJpegTranPad */
+  GList *extra_pads;
+  guint extra_pad_count;
 };
 
 G_END_DECLS
-static void
-gst_jpegtran_finalize (Gstjpegtran * filter);
 
 #endif /* __GST_JPEGTRAN_H__ */
@@ -0,0 +1,243 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Workers and libturbojpeg handles shared by all jpegtran instances of
+ * the process, so that threads and memory follow the number of CPUs
+ * rather than the number of streams.
+ *
+ * Every stream with frame-parallel transforms is a client with a queue
+ * of its own. The workers take one task at a time from the clients in
+ * turn, so a busy stream can not starve the others, and a client never
+ * has more than its max_running tasks on the workers. Restart-interval
+ * stripes go to a separate pool, the frame waiting for them may itself
+ * be running on a worker. */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "gstjpegtranpool.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_jpegtran_pool_debug);
+#define GST_CAT_DEFAULT gst_jpegtran_pool_debug
+
+struct _GstJpegTranClient
+{
+  GQueue tasks;
+  guint running, max_running;
+  /* in pool.ready */
+  gboolean ready;
+};
+
+static struct
+{
+  GMutex lock;
+  /* a client became ready */
+  GCond cond;
+  /* a task finished */
+  GCond done;
+  /* clients with tasks to run, in turn */
+  GQueue ready;
+  guint n_threads, max_threads;
+  /* idle tjInitTransform() handles */
+  GQueue handles;
+  GThreadPool *stripes;
+} pool;
+
+tjhandle
+gst_jpegtran_pool_get_handle (void)
+{
+  tjhandle handle;
+
+  g_mutex_lock (&pool.lock);
+  handle = g_queue_pop_head (&pool.handles);
+  g_mutex_unlock (&pool.lock);
+
+  if (handle == NULL) {
+    handle = tjInitTransform ();
+    if (handle == NULL)
+      GST_WARNING ("cannot init transform: %s", tjGetErrorStr2 (NULL));
+  }
+
+  return handle;
+}
+
+/* the most recently used handle is handed out first, its memory is the
+ * most likely to be warm */
+void
+gst_jpegtran_pool_put_handle (tjhandle handle)
+{
+  if (handle == NULL)
+    return;
+
+  g_mutex_lock (&pool.lock);
+  g_queue_push_head (&pool.handles, handle);
+  g_mutex_unlock (&pool.lock);
+}
+
+/* called with the lock */
+static void
+gst_jpegtran_client_schedule (GstJpegTranClient * client)
+{
+  if (client->ready || g_queue_is_empty (&client->tasks)
+      || client->running >= client->max_running)
+    return;
+
+  client->ready = TRUE;
+  g_queue_push_tail (&pool.ready, client);
+  g_cond_signal (&pool.cond);
+}
+
+static gpointer
+gst_jpegtran_pool_thread (gpointer data)
+{
+  tjhandle handle = gst_jpegtran_pool_get_handle ();
+
+  g_mutex_lock (&pool.lock);
+  for (;;) {
+    GstJpegTranClient *client;
+    GstJpegTranTask *task;
+
+    while ((client = g_queue_pop_head (&pool.ready)) == NULL)
+      g_cond_wait (&pool.cond, &pool.lock);
+
+    /* to the back of the line, behind every other waiting stream */
+    task = g_queue_pop_head (&client->tasks);
+    client->ready = FALSE;
+    client->running++;
+    gst_jpegtran_client_schedule (client);
+    g_mutex_unlock (&pool.lock);
+
+    task->func (task, handle, task->user_data);
+
+    g_mutex_lock (&pool.lock);
+    client->running--;
+    gst_jpegtran_client_schedule (client);
+    g_cond_broadcast (&pool.done);
+  }
+
+  return NULL;
+}
+
+static void
+gst_jpegtran_pool_stripe_func (gpointer data, gpointer user_data)
+{
+  GstJpegTranTask *task = data;
+  tjhandle handle = gst_jpegtran_pool_get_handle ();
+
+  task->func (task, handle, task->user_data);
+  gst_jpegtran_pool_put_handle (handle);
+}
+
+/* from plugin_init, the threads only start with the first client */
+void
+gst_jpegtran_pool_init (void)
+{
+  GST_DEBUG_CATEGORY_INIT (gst_jpegtran_pool_debug, "jpegtranpool", 0,
+      "jpegtran shared workers");
+
+  g_mutex_init (&pool.lock);
+  g_cond_init (&pool.cond);
+  g_cond_init (&pool.done);
+  g_queue_init (&pool.ready);
+  g_queue_init (&pool.handles);
+  pool.n_threads = 0;
+  pool.max_threads = g_get_num_processors ();
+  pool.stripes = g_thread_pool_new (gst_jpegtran_pool_stripe_func, NULL,
+      pool.max_threads, FALSE, NULL);
+
+  GST_DEBUG ("up to %u workers", pool.max_threads);
+}
+
+/* a stream with at most max_running of its tasks on the workers at the
+ * same time */
+GstJpegTranClient *
+gst_jpegtran_client_new (guint max_running)
+{
+  GstJpegTranClient *client = g_new0 (GstJpegTranClient, 1);
+
+  g_queue_init (&client->tasks);
+  client->max_running = MAX (max_running, 1);
+
+  g_mutex_lock (&pool.lock);
+  while (pool.n_threads < pool.max_threads) {
+    gchar *name = g_strdup_printf ("jpegtran-%u", pool.n_threads);
+
+    g_thread_unref (g_thread_new (name, gst_jpegtran_pool_thread, NULL));
+    g_free (name);
+    pool.n_threads++;
+  }
+  g_mutex_unlock (&pool.lock);
+
+  return client;
+}
+
+/* drops the tasks still queued and waits for the running ones */
+void
+gst_jpegtran_client_free (GstJpegTranClient * client)
+{
+  g_mutex_lock (&pool.lock);
+  g_queue_clear (&client->tasks);
+  if (client->ready)
+    g_queue_remove (&pool.ready, client);
+  while (client->running > 0)
+    g_cond_wait (&pool.done, &pool.lock);
+  g_mutex_unlock (&pool.lock);
+
+  g_free (client);
+}
+
+void
+gst_jpegtran_client_push (GstJpegTranClient * client, GstJpegTranTask * task)
+{
+  g_mutex_lock (&pool.lock);
+  g_queue_push_tail (&client->tasks, task);
+  gst_jpegtran_client_schedule (client);
+  g_mutex_unlock (&pool.lock);
+}
+
+void
+gst_jpegtran_pool_push_stripe (GstJpegTranTask * task)
+{
+  g_thread_pool_push (pool.stripes, task, NULL);
+}
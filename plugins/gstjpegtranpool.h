@@ -0,0 +1,81 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __GST_JPEGTRAN_POOL_H__
+#define __GST_JPEGTRAN_POOL_H__
+
+#include <gst/gst.h>
+#include <turbojpeg.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstJpegTranTask GstJpegTranTask;
+typedef struct _GstJpegTranClient GstJpegTranClient;
+
+/* handle is a tjInitTransform() handle of the running thread, NULL
+ * when libturbojpeg could not make one */
+typedef void (*GstJpegTranTaskFunc) (GstJpegTranTask * task,
+    tjhandle handle, gpointer user_data);
+
+/* embedded at the start of whatever the workers are handed */
+struct _GstJpegTranTask
+{
+  GstJpegTranTaskFunc func;
+  gpointer user_data;
+};
+
+void gst_jpegtran_pool_init (void);
+
+tjhandle gst_jpegtran_pool_get_handle (void);
+void gst_jpegtran_pool_put_handle (tjhandle handle);
+
+GstJpegTranClient *gst_jpegtran_client_new (guint max_running);
+void gst_jpegtran_client_free (GstJpegTranClient * client);
+void gst_jpegtran_client_push (GstJpegTranClient * client,
+    GstJpegTranTask * task);
+
+void gst_jpegtran_pool_push_stripe (GstJpegTranTask * task);
+
+G_END_DECLS
+
+#endif /* __GST_JPEGTRAN_POOL_H__ */
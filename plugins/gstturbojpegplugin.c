@@ -47,10 +47,13 @@
 
 #include <gst/gst.h>
 #include "gstjpegtran.h"
+#include "gstjpegtranpool.h"
 
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
+  gst_jpegtran_pool_init ();
+
   gst_element_register (plugin, "jpegtran", GST_RANK_NONE,
 			GST_TYPE_JPEGTRAN);
 
@@ -0,0 +1,269 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Unit checks of the marker helpers: the frame header parser, the
+ * byte stream framer and the EXIF orientation reader and writers. */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+
+#include "gstjpegmarkers.h"
+
+/* SOI, DRI of 3 MCUs, SOF0 of 33x17 4:2:0 and SOS of all components */
+static const guint8 header_420[] = {
+  0xFF, 0xD8,
+  0xFF, 0xDD, 0x00, 0x04, 0x00, 0x03,
+  0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x11, 0x00, 0x21, 0x03,
+  0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+  0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11,
+  0x00, 0x3F, 0x00,
+  0x12, 0x34
+};
+
+static void
+test_frame_info (void)
+{
+  GstJpegFrameInfo info;
+
+  g_assert_true (gst_jpeg_parse_frame_info (header_420,
+          sizeof (header_420), &info));
+  g_assert_cmpuint (info.sof_marker, ==, JPEG_MARKER_SOF0);
+  g_assert_cmpuint (info.width, ==, 33);
+  g_assert_cmpuint (info.height, ==, 17);
+  g_assert_cmpuint (info.n_components, ==, 3);
+  g_assert_cmpuint (info.scan_components, ==, 3);
+  g_assert_cmpuint (info.restart_interval, ==, 3);
+  g_assert_cmpuint (info.dri_offset, ==, 2);
+  g_assert_cmpuint (info.sof_offset, ==, 8);
+  g_assert_cmpuint (info.scan_offset, ==, sizeof (header_420) - 2);
+  g_assert_true (gst_jpeg_frame_info_is_baseline (&info));
+  g_assert_cmpuint (gst_jpeg_frame_info_mcu_width (&info), ==, 16);
+  g_assert_cmpuint (gst_jpeg_frame_info_mcu_height (&info), ==, 16);
+  g_assert_cmpuint (gst_jpeg_frame_info_mcus_per_row (&info), ==, 3);
+
+  /* cut inside the SOF */
+  g_assert_false (gst_jpeg_parse_frame_info (header_420, 14, &info));
+}
+
+/* junk, an image whose APP1 holds an EOI and an SOI, more junk and a
+ * second image with stuffed bytes and a restart marker in its scan */
+static const guint8 stream[] = {
+  0x00, 0xFF, 0x12,
+  0xFF, 0xD8,
+  0xFF, 0xE1, 0x00, 0x08, 'a', 0xFF, 0xD9, 0xFF, 0xD8, 'b',
+  0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00,
+  0x12, 0xFF, 0x00, 0x34, 0xFF, 0xD0, 0x56,
+  0xFF, 0xD9,
+  0x55, 0xFF,
+  0xFF, 0xD8,
+  0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00,
+  0xAA, 0xFF, 0xFF, 0xD9
+};
+
+/* stream offsets just past each marker the framer reports */
+static const struct
+{
+  GstJpegFramerEvent event;
+  gsize end;
+} stream_events[] = {
+  {GST_JPEG_FRAMER_SOI, 5},
+  {GST_JPEG_FRAMER_EOI, 34},
+  {GST_JPEG_FRAMER_SOI, 38},
+  {GST_JPEG_FRAMER_EOI, 52}
+};
+
+static void
+test_framer (void)
+{
+  gsize chunk;
+
+  g_assert_cmpuint (sizeof (stream), ==, 52);
+
+  /* the same events however the stream is split */
+  for (chunk = 1; chunk <= sizeof (stream); chunk++) {
+    GstJpegFramer framer;
+    gsize offset = 0, end = 0;
+    guint n_events = 0;
+
+    gst_jpeg_framer_reset (&framer);
+    g_assert_false (gst_jpeg_framer_in_image (&framer));
+
+    while (offset < sizeof (stream)) {
+      GstJpegFramerEvent event;
+
+      if (offset == end)
+        end = MIN (offset + chunk, sizeof (stream));
+      offset += gst_jpeg_framer_scan (&framer, stream + offset,
+          end - offset, &event);
+      if (event == GST_JPEG_FRAMER_NONE) {
+        g_assert_cmpuint (offset, ==, end);
+        continue;
+      }
+
+      g_assert_cmpuint (n_events, <, G_N_ELEMENTS (stream_events));
+      g_assert_cmpint (event, ==, stream_events[n_events].event);
+      g_assert_cmpuint (offset, ==, stream_events[n_events].end);
+      g_assert_true (gst_jpeg_framer_in_image (&framer) ==
+          (event == GST_JPEG_FRAMER_SOI));
+      n_events++;
+    }
+    g_assert_cmpuint (n_events, ==, G_N_ELEMENTS (stream_events));
+  }
+}
+
+static void
+test_exif_orientation (void)
+{
+  guint8 data[2 + JPEG_EXIF_ORIENTATION_SEGMENT_SIZE] = { 0xFF, 0xD8 };
+  GstJpegExifOrientation orientation;
+  GstJpegSegment seg;
+  gsize offset = 2;
+
+  gst_jpeg_write_exif_orientation_segment (data + 2, 6);
+  g_assert_true (gst_jpeg_next_segment (data, sizeof (data), &offset,
+          &seg));
+  g_assert_cmpuint (seg.size, ==, JPEG_EXIF_ORIENTATION_SEGMENT_SIZE);
+  g_assert_true (gst_jpeg_segment_is_exif (&seg));
+  /* there is one already */
+  g_assert_cmpuint (gst_jpeg_exif_add_orientation_size (&seg), ==, 0);
+
+  g_assert_true (gst_jpeg_find_exif_orientation (data, sizeof (data),
+          &orientation));
+  g_assert_cmpuint (orientation.value, ==, 6);
+  g_assert_true (orientation.big_endian);
+
+  gst_jpeg_write_exif_orientation (data, &orientation, 3);
+  g_assert_true (gst_jpeg_find_exif_orientation (data, sizeof (data),
+          &orientation));
+  g_assert_cmpuint (orientation.value, ==, 3);
+
+  /* the JFIF APP0 of a plain file */
+  g_assert_false (gst_jpeg_find_exif_orientation (header_420,
+          sizeof (header_420), &orientation));
+}
+
+/* a little endian EXIF APP1 whose IFD0 holds Make, stored in the entry,
+ * and an ExifIFD pointer but no Orientation, followed by an odd byte of
+ * other data */
+static const guint8 exif_le[] = {
+  0xFF, 0xD8,
+  0xFF, 0xE1, 0x00, 0x2F,
+  'E', 'x', 'i', 'f', 0x00, 0x00,
+  'I', 'I', 0x2A, 0x00, 0x08, 0x00, 0x00, 0x00,
+  0x02, 0x00,
+  0x0F, 0x01, 0x02, 0x00, 0x04, 0x00, 0x00, 0x00, 'C', 'a', 'm', 0x00,
+  0x69, 0x87, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00, 0x26, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00,
+  0x42
+};
+
+static void
+test_exif_add_orientation (void)
+{
+  GstJpegExifOrientation orientation;
+  GstJpegSegment seg, added;
+  const guint8 *tiff;
+  guint8 *data;
+  gsize offset = 2;
+  guint grow, ifd;
+
+  g_assert_true (gst_jpeg_next_segment (exif_le, sizeof (exif_le), &offset,
+          &seg));
+  g_assert_cmpuint (seg.size, ==, sizeof (exif_le) - 2);
+  g_assert_false (gst_jpeg_find_exif_orientation (exif_le, sizeof (exif_le),
+          &orientation));
+
+  /* 39 bytes of TIFF data, one of padding and the IFD0 copy */
+  grow = gst_jpeg_exif_add_orientation_size (&seg);
+  g_assert_cmpuint (grow, ==, 1 + 2 + 3 * 12 + 4);
+
+  data = g_malloc0 (2 + seg.size + grow);
+  memcpy (data, exif_le, 2);
+  gst_jpeg_write_exif_add_orientation (data + 2, &seg, 8);
+
+  offset = 2;
+  g_assert_true (gst_jpeg_next_segment (data, 2 + seg.size + grow, &offset,
+          &added));
+  g_assert_cmpuint (added.size, ==, seg.size + grow);
+  g_assert_cmpuint (gst_jpeg_exif_add_orientation_size (&added), ==, 0);
+  /* what was there is untouched, the TIFF header aside */
+  g_assert_cmpmem (added.data + 14, seg.length - 14, seg.data + 14,
+      seg.length - 14);
+
+  g_assert_true (gst_jpeg_find_exif_orientation (data, 2 + seg.size + grow,
+          &orientation));
+  g_assert_cmpuint (orientation.value, ==, 8);
+  g_assert_false (orientation.big_endian);
+
+  /* the entries stay in tag order, the rest is copied as it was */
+  tiff = added.data + 6;
+  ifd = GST_READ_UINT32_LE (tiff + 4);
+  g_assert_cmpuint (ifd, ==, 40);
+  g_assert_cmpuint (GST_READ_UINT16_LE (tiff + ifd), ==, 3);
+  g_assert_cmpuint (GST_READ_UINT16_LE (tiff + ifd + 2), ==, 0x010F);
+  g_assert_cmpmem (tiff + ifd + 2 + 8, 4, "Cam", 4);
+  g_assert_cmpuint (GST_READ_UINT16_LE (tiff + ifd + 14), ==, 0x0112);
+  g_assert_cmpuint (GST_READ_UINT16_LE (tiff + ifd + 26), ==, 0x8769);
+  g_assert_cmpuint (GST_READ_UINT32_LE (tiff + ifd + 26 + 8), ==, 0x26);
+  g_assert_cmpuint (GST_READ_UINT32_LE (tiff + ifd + 38), ==, 0);
+
+  g_free (data);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/jpegmarkers/frame-info", test_frame_info);
+  g_test_add_func ("/jpegmarkers/framer", test_framer);
+  g_test_add_func ("/jpegmarkers/exif-orientation", test_exif_orientation);
+  g_test_add_func ("/jpegmarkers/exif-add-orientation",
+      test_exif_add_orientation);
+
+  return g_test_run ();
+}
@@ -0,0 +1,256 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* The restart interval stripes of jpegtran against a single tjTransform()
+ * of the whole frame. The stitched output has to decode to the same
+ * pixels without warnings, which covers the DRI written over it, the
+ * renumbered RST markers and the reversed stripe order of vertical
+ * flips, also when gray=true halves the MCU height of subsampled
+ * input. */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <gst/check/gstharness.h>
+#include <turbojpeg.h>
+
+#include "gstjpegmarkers.h"
+
+/* 3 stripes of 480 rows on as many stripe threads */
+#define WIDTH 2560
+#define HEIGHT 1440
+#define N_STRIPES 3
+
+static const struct
+{
+  const gchar *name;
+  gint subsamp;
+  const gchar *caps;
+} samplings[] = {
+  {"444", TJSAMP_444, "YCbCr-4:4:4"},
+  {"422", TJSAMP_422, "YCbCr-4:2:2"},
+  {"420", TJSAMP_420, "YCbCr-4:2:0"},
+  {"gray", TJSAMP_GRAY, "GRAYSCALE"}
+};
+
+/* the xops stripes are used for */
+static const struct
+{
+  const gchar *nick;
+  gint op;
+} xops[] = {
+  {"none", TJXOP_NONE},
+  {"hflip", TJXOP_HFLIP},
+  {"vflip", TJXOP_VFLIP},
+  {"rot180", TJXOP_ROT180}
+};
+
+/* noisy gradients with a restart marker after every MCU row */
+static GstBuffer *
+make_jpeg (gint subsamp)
+{
+  tjhandle handle = tjInitCompress ();
+  unsigned char *jpeg = NULL;
+  unsigned long size = 0;
+  guint8 *rgb, *p;
+  GRand *rand;
+  gint x, y;
+
+  rand = g_rand_new_with_seed (subsamp);
+  rgb = g_malloc ((gsize) WIDTH * HEIGHT * 3);
+  for (y = 0, p = rgb; y < HEIGHT; y++) {
+    for (x = 0; x < WIDTH; x++, p += 3) {
+      gint noise = g_rand_int_range (rand, -12, 12);
+
+      p[0] = CLAMP (x * 255 / WIDTH + noise, 0, 255);
+      p[1] = CLAMP (y * 255 / HEIGHT + noise, 0, 255);
+      p[2] = CLAMP (((x ^ y) & 0xFF) / 2 + 64 + noise, 0, 255);
+    }
+  }
+  g_rand_free (rand);
+
+  /* libturbojpeg only takes the restart interval from the environment */
+  g_setenv ("TJ_RESTART", "1", TRUE);
+  g_assert_cmpint (tjCompress2 (handle, rgb, WIDTH, 0, HEIGHT, TJPF_RGB,
+          &jpeg, &size, subsamp, 85, 0), ==, 0);
+  g_unsetenv ("TJ_RESTART");
+
+  g_free (rgb);
+  tjDestroy (handle);
+
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, jpeg, size,
+      0, size, jpeg, (GDestroyNotify) tjFree);
+}
+
+/* RGB pixels, a warning about a restart marker fails as well */
+static guint8 *
+decode (const guint8 * data, gsize size, gint * width, gint * height)
+{
+  tjhandle handle = tjInitDecompress ();
+  gint subsamp, colorspace;
+  guint8 *pixels;
+
+  g_assert_cmpint (tjDecompressHeader3 (handle, data, size, width, height,
+          &subsamp, &colorspace), ==, 0);
+  pixels = g_malloc ((gsize) * width * *height * 3);
+  if (tjDecompress2 (handle, data, size, pixels, *width, 0, *height,
+          TJPF_RGB, TJFLAG_STOPONWARNING) != 0)
+    g_error ("cannot decode: %s", tjGetErrorStr2 (handle));
+  tjDestroy (handle);
+
+  return pixels;
+}
+
+static GstBuffer *
+run_jpegtran (GstBuffer * frame, const gchar * caps, const gchar * xop,
+    gboolean gray)
+{
+  GstElement *element;
+  GstHarness *h;
+  GstBuffer *out;
+
+  element = gst_element_factory_make ("jpegtran", NULL);
+  g_assert_nonnull (element);
+  gst_util_set_object_arg (G_OBJECT (element), "xop", xop);
+  g_object_set (element, "gray", gray, "n-stripe-threads", N_STRIPES, NULL);
+
+  h = gst_harness_new_with_element (element, "sink", "src");
+  gst_harness_play (h);
+  gst_harness_set_src_caps_str (h, caps);
+  g_assert_cmpint (gst_harness_push (h, gst_buffer_ref (frame)), ==,
+      GST_FLOW_OK);
+  out = gst_harness_pull (h);
+  g_assert_nonnull (out);
+
+  gst_harness_teardown (h);
+  gst_object_unref (element);
+
+  return out;
+}
+
+static void
+check_stripes (guint s, guint x, gboolean gray)
+{
+  tjhandle handle = tjInitTransform ();
+  tjtransform xform = { 0, };
+  GstJpegFrameInfo info;
+  GstBuffer *frame, *striped;
+  GstMapInfo in_map, out_map;
+  unsigned char *whole = NULL;
+  unsigned long whole_size = 0;
+  guint8 *a, *b;
+  gint aw, ah, bw, bh;
+  gchar *caps;
+
+  frame = make_jpeg (samplings[s].subsamp);
+  caps = g_strdup_printf ("image/jpeg, width=%d, height=%d, sampling=%s, "
+      "framerate=30/1, parsed=true", WIDTH, HEIGHT, samplings[s].caps);
+  striped = run_jpegtran (frame, caps, xops[x].nick, gray);
+  g_free (caps);
+
+  gst_buffer_map (frame, &in_map, GST_MAP_READ);
+  xform.op = xops[x].op;
+  xform.options = TJXOPT_TRIM | (gray ? TJXOPT_GRAY : 0);
+  g_assert_cmpint (tjTransform (handle, in_map.data, in_map.size, 1, &whole,
+          &whole_size, &xform, 0), ==, 0);
+  gst_buffer_unmap (frame, &in_map);
+  tjDestroy (handle);
+
+  gst_buffer_map (striped, &out_map, GST_MAP_READ);
+
+  /* a single tjTransform() writes no DRI, the stitched stripes one per
+   * stripe in output MCUs */
+  g_assert_true (gst_jpeg_parse_frame_info (out_map.data, out_map.size,
+          &info));
+  g_assert_cmpuint (info.restart_interval, ==,
+      gst_jpeg_frame_info_mcus_per_row (&info) * (HEIGHT / N_STRIPES) /
+      gst_jpeg_frame_info_mcu_height (&info));
+
+  a = decode (whole, whole_size, &aw, &ah);
+  b = decode (out_map.data, out_map.size, &bw, &bh);
+  g_assert_cmpint (aw, ==, bw);
+  g_assert_cmpint (ah, ==, bh);
+  g_assert_cmpmem (a, (gsize) aw * ah * 3, b, (gsize) bw * bh * 3);
+
+  g_free (a);
+  g_free (b);
+  tjFree (whole);
+  gst_buffer_unmap (striped, &out_map);
+  gst_buffer_unref (striped);
+  gst_buffer_unref (frame);
+}
+
+static void
+test_stripes (gconstpointer data)
+{
+  guint n = GPOINTER_TO_UINT (data);
+
+  check_stripes (n / (G_N_ELEMENTS (xops) * 2),
+      n / 2 % G_N_ELEMENTS (xops), n % 2);
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint s, x, gray;
+
+  gst_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  for (s = 0; s < G_N_ELEMENTS (samplings); s++) {
+    for (x = 0; x < G_N_ELEMENTS (xops); x++) {
+      for (gray = 0; gray < 2; gray++) {
+        gchar *path = g_strdup_printf ("/jpegtran/stripes/%s/%s%s",
+            samplings[s].name, xops[x].nick, gray ? "/gray" : "");
+
+        g_test_add_data_func (path, GUINT_TO_POINTER ((s *
+                    G_N_ELEMENTS (xops) + x) * 2 + gray), test_stripes);
+        g_free (path);
+      }
+    }
+  }
+
+  return g_test_run ();
+}
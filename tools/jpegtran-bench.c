@@ -0,0 +1,409 @@
+/*
+ * GStreamer
+ * Copyright (C) 2023 Petri Ahonen <peahonen@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Alternatively, the contents of this file may be used under the
+ * GNU Lesser General Public License Version 2.1 (the "LGPL"), in
+ * which case the following provisions apply instead of the ones
+ * mentioned above:
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Throughput of jpegtran on synthetic JPEGs.
+ *
+ * Every combination of size, sampling, restart interval and xop is run
+ * through appsrc ! jpegtran ! fakesink, and unless --no-baseline is
+ * given also through jpegdec ! videoflip ! jpegenc for comparison. All
+ * input buffers share the memory of one encoded frame, so the numbers
+ * are the cost of the element alone. */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <gst/gst.h>
+#include <string.h>
+#include <turbojpeg.h>
+
+/* frames per run are picked to push about this many pixels through */
+#define PIXELS_PER_RUN 100000000
+#define MIN_FRAMES 5
+
+static const struct
+{
+  const gchar *name;
+  gint width, height;
+} sizes[] = {
+  {"vga", 640, 480},
+  {"720p", 1280, 720},
+  {"1080p", 1920, 1080},
+  {"4k", 3840, 2160},
+  {"8k", 7680, 4320}
+};
+
+static const struct
+{
+  const gchar *name;
+  gint subsamp;
+  const gchar *caps;
+} samplings[] = {
+  {"444", TJSAMP_444, "YCbCr-4:4:4"},
+  {"422", TJSAMP_422, "YCbCr-4:2:2"},
+  {"420", TJSAMP_420, "YCbCr-4:2:0"},
+  {"gray", TJSAMP_GRAY, "GRAYSCALE"}
+};
+
+/* restart interval in MCU rows, 0 for none */
+static const guint restarts[] = { 0, 1 };
+
+/* GstJpegTranXop nicks and the videoflip method doing the same */
+static const struct
+{
+  const gchar *xop;
+  const gchar *method;
+} xops[] = {
+  {"none", "none"},
+  {"hflip", "horizontal-flip"},
+  {"vflip", "vertical-flip"},
+  {"transpose", "upper-left-diagonal"},
+  {"transverse", "upper-right-diagonal"},
+  {"rot90", "clockwise"},
+  {"rot180", "rotate-180"},
+  {"rot270", "counterclockwise"},
+  {"auto", "automatic"}
+};
+
+typedef struct
+{
+  guint64 frames;
+  guint64 bytes_out;
+  guint64 allocations;
+  GHashTable *pooled;
+  GstBuffer *input;
+} BenchCounters;
+
+static guint8 *
+bench_make_jpeg (gint width, gint height, gint subsamp, guint restart,
+    unsigned long *size)
+{
+  tjhandle handle = tjInitCompress ();
+  unsigned char *jpeg = NULL;
+  guint8 *rgb, *p;
+  GRand *rand;
+  gchar *env;
+  gint x, y;
+
+  if (handle == NULL)
+    return NULL;
+
+  /* smooth gradients with some noise, compresses like a camera frame */
+  rand = g_rand_new_with_seed (width ^ height);
+  rgb = g_malloc ((gsize) width * height * 3);
+  for (y = 0, p = rgb; y < height; y++) {
+    for (x = 0; x < width; x++, p += 3) {
+      gint noise = g_rand_int_range (rand, -12, 12);
+
+      p[0] = CLAMP (x * 255 / width + noise, 0, 255);
+      p[1] = CLAMP (y * 255 / height + noise, 0, 255);
+      p[2] = CLAMP (((x ^ y) & 0xFF) / 2 + 64 + noise, 0, 255);
+    }
+  }
+  g_rand_free (rand);
+
+  /* libturbojpeg only takes the restart interval from the environment */
+  env = g_strdup_printf ("%u", restart);
+  if (restart > 0)
+    g_setenv ("TJ_RESTART", env, TRUE);
+  else
+    g_unsetenv ("TJ_RESTART");
+  g_free (env);
+
+  if (tjCompress2 (handle, rgb, width, 0, height, TJPF_RGB, &jpeg, size,
+          subsamp, 85, 0) < 0) {
+    g_printerr ("cannot compress: %s\n", tjGetErrorStr2 (handle));
+    jpeg = NULL;
+  }
+  g_unsetenv ("TJ_RESTART");
+
+  g_free (rgb);
+  tjDestroy (handle);
+
+  return jpeg;
+}
+
+/* an output buffer costs an allocation unless it is the input or a pool
+ * buffer that was seen before */
+static void
+bench_handoff (GstElement * sink, GstBuffer * buf, GstPad * pad,
+    BenchCounters * counters)
+{
+  counters->frames++;
+  counters->bytes_out += gst_buffer_get_size (buf);
+
+  if (gst_buffer_n_memory (buf) > 0 && counters->input != NULL
+      && gst_buffer_peek_memory (buf, 0) ==
+      gst_buffer_peek_memory (counters->input, 0))
+    return;
+
+  if (buf->pool == NULL)
+    counters->allocations++;
+  else if (g_hash_table_add (counters->pooled, buf))
+    counters->allocations++;
+}
+
+/* runs n_frames through the pipeline, returns the wall time or
+ * GST_CLOCK_TIME_NONE on error */
+static GstClockTime
+bench_run (const gchar * description, GstBuffer * frame, GstCaps * caps,
+    guint n_frames, BenchCounters * counters)
+{
+  GstElement *pipeline, *src, *sink;
+  GstMessage *msg;
+  GError *err = NULL;
+  GstFlowReturn flow;
+  gint64 start, end;
+  guint i;
+
+  pipeline = gst_parse_launch (description, &err);
+  if (pipeline == NULL) {
+    g_printerr ("%s: %s\n", description, err->message);
+    g_clear_error (&err);
+    return GST_CLOCK_TIME_NONE;
+  }
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (src, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (bench_handoff), counters);
+
+  counters->frames = counters->bytes_out = counters->allocations = 0;
+  counters->pooled = g_hash_table_new (NULL, NULL);
+  counters->input = frame;
+
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  for (i = 0; i < n_frames; i++) {
+    GstBuffer *buf = gst_buffer_copy (frame);
+
+    GST_BUFFER_PTS (buf) = i * GST_SECOND / 30;
+    GST_BUFFER_DURATION (buf) = GST_SECOND / 30;
+    g_signal_emit_by_name (src, "push-buffer", buf, &flow);
+    gst_buffer_unref (buf);
+    if (flow != GST_FLOW_OK)
+      break;
+  }
+  g_signal_emit_by_name (src, "end-of-stream", &flow);
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = g_get_monotonic_time ();
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("%s: %s\n", description, err->message);
+    g_clear_error (&err);
+    end = start - 1;
+  }
+  gst_message_unref (msg);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_hash_table_unref (counters->pooled);
+  counters->pooled = NULL;
+  gst_object_unref (src);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  if (end < start)
+    return GST_CLOCK_TIME_NONE;
+
+  return (end - start) * GST_USECOND;
+}
+
+static void
+bench_report (const gchar * what, const gchar * size, const gchar * sampling,
+    guint restart, const gchar * xop, gsize in_size, GstClockTime elapsed,
+    const BenchCounters * counters)
+{
+  gdouble seconds = (gdouble) elapsed / GST_SECOND;
+
+  if (!GST_CLOCK_TIME_IS_VALID (elapsed) || counters->frames == 0) {
+    g_print ("%-9s %-6s %-5s %3u %-10s failed\n", what, size, sampling,
+        restart, xop);
+    return;
+  }
+
+  g_print ("%-9s %-6s %-5s %3u %-10s %10.1f %10.1f %8.2f\n", what, size,
+      sampling, restart, xop, counters->frames / seconds,
+      counters->frames * in_size / seconds / 1e6,
+      (gdouble) counters->allocations / counters->frames);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gchar *size_list = NULL, *xop_list = NULL;
+  gchar **only_sizes = NULL, **only_xops = NULL;
+  gboolean no_baseline = FALSE, have_baseline;
+  gint frames = 0;
+  GOptionEntry entries[] = {
+    {"sizes", 's', 0, G_OPTION_ARG_STRING, &size_list,
+        "Comma separated sizes to run (vga,720p,1080p,4k,8k)", NULL},
+    {"xops", 'x', 0, G_OPTION_ARG_STRING, &xop_list,
+        "Comma separated xops to run", NULL},
+    {"frames", 'n', 0, G_OPTION_ARG_INT, &frames,
+        "Frames per run, by default about 100 Mpixels worth", NULL},
+    {"no-baseline", 0, 0, G_OPTION_ARG_NONE, &no_baseline,
+        "Skip jpegdec ! videoflip ! jpegenc", NULL},
+    {NULL}
+  };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GstElementFactory *factory;
+  guint s, m, r, x;
+
+  ctx = g_option_context_new ("- jpegtran throughput benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  if (size_list)
+    only_sizes = g_strsplit (size_list, ",", -1);
+  if (xop_list)
+    only_xops = g_strsplit (xop_list, ",", -1);
+
+  factory = gst_element_factory_find ("jpegtran");
+  if (factory == NULL) {
+    g_printerr ("jpegtran not found, check GST_PLUGIN_PATH\n");
+    return 1;
+  }
+  gst_object_unref (factory);
+
+  have_baseline = !no_baseline;
+  if (have_baseline) {
+    const gchar *needed[] = { "jpegdec", "videoflip", "jpegenc" };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (needed); i++) {
+      factory = gst_element_factory_find (needed[i]);
+      if (factory == NULL) {
+        g_printerr ("%s not found, skipping the baseline\n", needed[i]);
+        have_baseline = FALSE;
+        break;
+      }
+      gst_object_unref (factory);
+    }
+  }
+
+  g_print ("%-9s %-6s %-5s %3s %-10s %10s %10s %8s\n", "pipeline", "size",
+      "samp", "rst", "xop", "frames/s", "MB/s in", "allocs");
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++) {
+    guint n_frames;
+
+    if (only_sizes && !g_strv_contains ((const gchar * const *) only_sizes,
+            sizes[s].name))
+      continue;
+
+    n_frames = frames > 0 ? frames : MAX (MIN_FRAMES,
+        PIXELS_PER_RUN / (sizes[s].width * sizes[s].height));
+
+    for (m = 0; m < G_N_ELEMENTS (samplings); m++) {
+      for (r = 0; r < G_N_ELEMENTS (restarts); r++) {
+        unsigned long jpeg_size;
+        guint8 *jpeg;
+        GstBuffer *frame;
+        GstCaps *caps;
+
+        jpeg = bench_make_jpeg (sizes[s].width, sizes[s].height,
+            samplings[m].subsamp, restarts[r], &jpeg_size);
+        if (jpeg == NULL)
+          return 1;
+
+        frame = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, jpeg,
+            jpeg_size, 0, jpeg_size, jpeg, (GDestroyNotify) tjFree);
+        caps = gst_caps_new_simple ("image/jpeg",
+            "width", G_TYPE_INT, sizes[s].width,
+            "height", G_TYPE_INT, sizes[s].height,
+            "sampling", G_TYPE_STRING, samplings[m].caps,
+            "framerate", GST_TYPE_FRACTION, 30, 1,
+            "parsed", G_TYPE_BOOLEAN, TRUE, NULL);
+
+        for (x = 0; x < G_N_ELEMENTS (xops); x++) {
+          BenchCounters counters = { 0, };
+          GstClockTime elapsed;
+          gchar *desc;
+
+          if (only_xops && !g_strv_contains ((const gchar * const *)
+                  only_xops, xops[x].xop))
+            continue;
+
+          desc = g_strdup_printf ("appsrc name=src ! jpegtran xop=%s ! "
+              "fakesink name=sink sync=false signal-handoffs=true",
+              xops[x].xop);
+          elapsed = bench_run (desc, frame, caps, n_frames, &counters);
+          bench_report ("jpegtran", sizes[s].name, samplings[m].name,
+              restarts[r], xops[x].xop, jpeg_size, elapsed, &counters);
+          g_free (desc);
+
+          if (!have_baseline)
+            continue;
+
+          desc = g_strdup_printf ("appsrc name=src ! jpegdec ! videoflip "
+              "method=%s ! jpegenc ! fakesink name=sink sync=false "
+              "signal-handoffs=true", xops[x].method);
+          elapsed = bench_run (desc, frame, caps, n_frames, &counters);
+          bench_report ("baseline", sizes[s].name, samplings[m].name,
+              restarts[r], xops[x].xop, jpeg_size, elapsed, &counters);
+          g_free (desc);
+        }
+
+        gst_caps_unref (caps);
+        gst_buffer_unref (frame);
+      }
+    }
+  }
+
+  g_strfreev (only_sizes);
+  g_strfreev (only_xops);
+  g_free (size_list);
+  g_free (xop_list);
+
+  return 0;
+}